@@ -0,0 +1,101 @@
+#include <cstdio>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include <boost/asio.hpp>
+
+#include "bench.h"
+#include "client.h"
+
+using namespace std;
+using namespace boost::asio;
+
+//heap allocations per message on the friend link in steady state: alice
+//writes messages, bob reads them, both on one io thread; fails when they
+//are not near zero
+//usage: alloc_bench [--binary] [warmup] [count] [message_size]
+int main(int argc, char *argv[])
+{
+    bool binary = false;
+    vector<size_t> args;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (string{argv[i]} == "--binary")
+        {
+            binary = true;
+        }
+        else
+        {
+            args.push_back(stoul(argv[i]));
+        }
+    }
+    //send buffer recycles strings, warmup lets the pool reach its size
+    size_t warmup = args.size() > 0 ? args[0] : 100000;
+    size_t count = args.size() > 1 ? args[1] : 100000;
+    string text(args.size() > 2 ? args[2] : 64, 'x');
+
+    local_server server;
+    uint16_t port = server.port();
+    quiet_clients();
+
+    io_service service;
+    io_service::work work{service};
+    client::ptr bob = client::create(service, "bob", "127.0.0.1", port, {});
+    client::ptr alice = client::create(service, "alice", "127.0.0.1", port,
+                                       {"bob"});
+    atomic<int> communicating{0};
+    bob->set_communication_handler([&communicating]{ ++communicating; });
+    alice->set_communication_handler([&communicating]{ ++communicating; });
+    //block producer instead of dropping messages
+    send_buffer::options opts;
+    opts.policy = send_buffer::overflow_policy::block;
+    alice->set_send_options(opts);
+    alice->set_binary_framing(binary);
+    thread io_thread{[&service]{ service.run(); }};
+
+    service.post([bob]{ bob->start(); });
+    this_thread::sleep_for(std::chrono::milliseconds(100));
+    service.post([alice]{ alice->start(); });
+    if (!wait_for([&communicating]{ return communicating == 2; }))
+    {
+        printf("friends are not connected\n");
+        return -1;
+    }
+
+    auto send = [&alice, &text](size_t messages)
+    {
+        size_t target = alice->friend_write_stats().messages + messages;
+        for (size_t i = 0; i < messages; ++i)
+        {
+            alice->write(text);
+        }
+        return wait_for(
+            [&alice, target]
+            { return alice->friend_write_stats().messages >= target; });
+    };
+
+    send(warmup);
+    //let bob drain what alice has written
+    this_thread::sleep_for(std::chrono::milliseconds(200));
+    size_t before = allocation_count();
+    auto start = std::chrono::steady_clock::now();
+    bool done = send(count);
+    this_thread::sleep_for(std::chrono::milliseconds(200));
+    size_t allocated = allocation_count() - before;
+    double seconds = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count();
+
+    printf("messages: %zu of %zu bytes, %s framing%s\n", count, text.size(),
+           binary ? "binary" : "text", done ? "" : " (not all written)");
+    printf("allocations: %zu, %.3f per message\n", allocated,
+           double(allocated) / count);
+    printf("throughput: %.0f messages/s\n", count / seconds);
+
+    service.stop();
+    io_thread.join();
+    server.stop();
+    return done && allocated <= count / 1000 ? 0 : 1;
+}
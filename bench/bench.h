@@ -0,0 +1,109 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <iostream>
+#include <boost/asio.hpp>
+
+#include "server/rendezvous_server.h"
+
+//keep value alive for the optimizer
+template <typename T>
+inline void do_not_optimize(const T &value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+//average nanoseconds per call of f, repeated for at least min_time
+template <typename F>
+double measure_ns(F f, std::chrono::milliseconds min_time =
+                           std::chrono::milliseconds{200})
+{
+    using clock = std::chrono::steady_clock;
+    size_t iterations = 0;
+    auto start = clock::now();
+    auto finish = start;
+    size_t batch = 1;
+    do
+    {
+        for (size_t i = 0; i < batch; ++i)
+        {
+            f();
+        }
+        iterations += batch;
+        batch *= 2;
+        finish = clock::now();
+    } while (finish - start < min_time);
+
+    return std::chrono::duration<double, std::nano>(finish - start).count() /
+            iterations;
+}
+
+//heap allocations of the process so far; only in benches linked with
+//alloc_counter.cpp, which replaces operator new
+size_t allocation_count();
+
+//wait until condition holds or timeout expires
+template <typename F>
+bool wait_for(F condition,
+              std::chrono::seconds timeout = std::chrono::seconds{10})
+{
+    auto finish = std::chrono::steady_clock::now() + timeout;
+    while (!condition())
+    {
+        if (std::chrono::steady_clock::now() > finish)
+        {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+//clients report every step to cout, keep only the results of the bench
+inline void quiet_clients()
+{
+    std::cout.setstate(std::ios::badbit);
+}
+
+//rendezvous server on loopback, run by own thread
+class local_server
+{
+public:
+    local_server() :
+        server{service, boost::asio::ip::tcp::endpoint{
+                   boost::asio::ip::make_address("127.0.0.1"), 0}}
+    {
+        server.start();
+        runner = std::thread{[this]{ service.run(); }};
+    }
+
+    ~local_server()
+    {
+        stop();
+    }
+
+    uint16_t port() const { return server.local_endpoint().port(); }
+
+    //server is not thread safe, stop it after its thread
+    void stop()
+    {
+        if (!runner.joinable())
+        {
+            return;
+        }
+        service.stop();
+        runner.join();
+        server.stop();
+    }
+
+private:
+    boost::asio::io_service service;
+    rendezvous_server server;
+    std::thread runner;
+};
+
+#endif // BENCH_H
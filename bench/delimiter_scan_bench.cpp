@@ -0,0 +1,72 @@
+#include <cctype>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+#include "bench.h"
+#include "delimiter_scan.h"
+
+using namespace std;
+
+//frame boundary check of the former client::read_complete
+static const char *find_if_isspace(const char *begin, const char *end)
+{
+    return find_if(begin, end, [](char c){ return isspace(c) && c != ' '; });
+}
+
+using scanner = const char *(*)(const char *, const char *);
+
+int main()
+{
+    struct variant { const char *name; scanner scan; };
+    vector<variant> variants = {
+        {"find_if", find_if_isspace},
+        {"scalar", find_line_delimiter_scalar},
+        {"sse2", find_line_delimiter_sse2},
+        {"avx2", find_line_delimiter_avx2},
+        {"dispatch", find_line_delimiter},
+    };
+
+    printf("dispatched scanner: %s\n", line_delimiter_scanner_name());
+    printf("%-10s %10s %12s %10s\n", "variant", "size", "ns/scan", "GB/s");
+
+    mt19937 gen{42};
+    uniform_int_distribution<int> chars{'!', '~'};
+    for (size_t size : {64, 1024, 64 * 1024})
+    {
+        //printable text with spaces, line terminator at the very end
+        string data(size, ' ');
+        generate(data.begin(), data.end(),
+                 [&]{ return gen() % 8 == 0 ? ' ' : char(chars(gen)); });
+        data[size - 2] = '\r';
+        data[size - 1] = '\n';
+
+        for (const variant &v : variants)
+        {
+            if ((v.scan == find_line_delimiter_avx2 && !avx2_supported()) ||
+                (v.scan == find_line_delimiter_sse2 && !sse2_supported()))
+            {
+                continue;
+            }
+
+            const char *result = nullptr;
+            double ns = measure_ns(
+                [&]
+                {
+                    result = v.scan(data.data(), data.data() + data.size());
+                    do_not_optimize(result);
+                });
+            if (result != data.data() + size - 2)
+            {
+                printf("%s: wrong result\n", v.name);
+                return 1;
+            }
+            printf("%-10s %10zu %12.1f %10.2f\n", v.name, size, ns,
+                   size / ns);
+        }
+    }
+
+    return 0;
+}
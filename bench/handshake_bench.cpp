@@ -0,0 +1,92 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#ifdef __unix__
+#include <sys/resource.h>
+#endif
+
+#include "bench.h"
+#include "load_generator.h"
+#include "percentiles.h"
+
+using namespace std;
+
+//every client session needs several descriptors
+static void raise_file_limit()
+{
+#ifdef __unix__
+    rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        printf("open files limit: %llu\n",
+               static_cast<unsigned long long>(limit.rlim_cur));
+    }
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    vector<size_t> pair_counts;
+    size_t threads = max(1u, thread::hardware_concurrency());
+    long timeout = 30;
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc)
+        {
+            threads = stoul(argv[++i]);
+        }
+        else if (arg == "--timeout" && i + 1 < argc)
+        {
+            timeout = stol(argv[++i]);
+        }
+        else
+        {
+            pair_counts.push_back(stoul(arg));
+        }
+    }
+    if (pair_counts.empty())
+    {
+        pair_counts = {1, 10, 100, 1000, 10000};
+    }
+
+    raise_file_limit();
+
+    local_server server;
+    uint16_t port = server.port();
+    quiet_clients();
+
+    printf("%8s %14s %10s %10s %10s %10s %10s\n", "pairs", "communicating",
+           "failed", "p50 ms", "p99 ms", "p999 ms", "max ms");
+    for (size_t round = 0; round < pair_counts.size(); ++round)
+    {
+        size_t sessions = pair_counts[round] * 2;
+        load_generator generator{"hs" + to_string(round) + "_",
+                                 "127.0.0.1", port, sessions, threads};
+
+        auto finish = std::chrono::steady_clock::now() +
+                      std::chrono::seconds(timeout);
+        generator.start();
+        while (generator.communicating() + generator.closed() < sessions &&
+               std::chrono::steady_clock::now() < finish)
+        {
+            this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        generator.stop();
+
+        percentiles res = percentiles::calculate(
+                generator.communication_latencies());
+        printf("%8zu %14zu %10zu %10.3f %10.3f %10.3f %10.3f\n",
+               pair_counts[round], res.count, sessions - res.count,
+               res.p50, res.p99, res.p999, res.max);
+    }
+
+    server.stop();
+    return 0;
+}
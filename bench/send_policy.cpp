@@ -0,0 +1,119 @@
+#include <cstdio>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+
+#include <boost/asio.hpp>
+
+#include "bench.h"
+#include "client.h"
+
+using namespace std;
+using namespace boost::asio;
+
+//link test and heartbeats of one friend pair while producers keep a tiny
+//send buffer full on both sides; pong, heartbeat and bulk frames must
+//neither wait for the budget on the strand nor be dropped with messages
+static bool run_pair(uint16_t port, const string &policy_name,
+                     send_buffer::overflow_policy policy)
+{
+    io_service service;
+    io_service::work work{service};
+    send_buffer::options opts;
+    opts.max_bytes = 512;
+    opts.high_watermark = 384;
+    opts.low_watermark = 128;
+    opts.policy = policy;
+    client::heartbeat_options heartbeat;
+    heartbeat.interval = boost::posix_time::milliseconds(10);
+    heartbeat.timeout = boost::posix_time::seconds(5);
+    link_bench::options bench;
+    bench.test = link_bench::mode::all;
+    bench.count = 200;
+
+    //names of earlier pairs may still be registered
+    string passive_name = "p-" + policy_name;
+    client::ptr passive = client::create(service, passive_name, "127.0.0.1",
+                                         port, {});
+    client::ptr active = client::create(service, "a-" + policy_name,
+                                        "127.0.0.1", port, {passive_name});
+    atomic<size_t> communicating{0};
+    atomic<int> result{-1};
+    for (const client::ptr &c : {passive, active})
+    {
+        c->set_send_options(opts);
+        c->set_heartbeat(heartbeat);
+        c->set_communication_handler([&communicating]{ ++communicating; });
+    }
+    active->set_link_bench(bench);
+    active->set_bench_handler([&result](bool complete)
+                              { result = complete ? 1 : 0; });
+
+    vector<thread> pool;
+    for (size_t i = 0; i < 2; ++i)
+    {
+        pool.emplace_back([&service]{ service.run(); });
+    }
+    passive->start();
+    this_thread::sleep_for(std::chrono::milliseconds(100));
+    active->start();
+    bool connected = wait_for([&communicating]
+                              { return communicating == 2; });
+
+    atomic<bool> flooding{connected};
+    vector<thread> writers;
+    for (const client::ptr &c : {passive, active})
+    {
+        writers.emplace_back([c, &flooding]
+        {
+            string text(100, 'm');
+            while (flooding)
+            {
+                c->write(text);
+            }
+        });
+    }
+    bool finished = connected &&
+                    wait_for([&result]{ return result != -1; },
+                             std::chrono::seconds{30});
+
+    //blocked producers are released by the writers, so the service stops
+    //after them
+    flooding = false;
+    for (auto &w : writers)
+    {
+        w.join();
+    }
+    service.stop();
+    for (auto &t : pool)
+    {
+        t.join();
+    }
+    return finished && result == 1;
+}
+
+//usage: send_policy
+int main()
+{
+    local_server server;
+    uint16_t port = server.port();
+    quiet_clients();
+
+    const pair<const char *, send_buffer::overflow_policy> policies[] = {
+        {"block", send_buffer::overflow_policy::block},
+        {"drop-oldest", send_buffer::overflow_policy::drop_oldest},
+        {"drop-newest", send_buffer::overflow_policy::drop_newest}};
+    bool ok = true;
+    for (const auto &policy : policies)
+    {
+        bool passed = run_pair(port, policy.first, policy.second);
+        printf("%s: %s\n", policy.first,
+               passed ? "link test finished" : "link test stalled");
+        ok = ok && passed;
+    }
+
+    server.stop();
+    return ok ? 0 : 1;
+}
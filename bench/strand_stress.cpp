@@ -0,0 +1,242 @@
+#include <cstdio>
+#include <atomic>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#include <boost/asio.hpp>
+
+#include "bench.h"
+#include "client.h"
+#include "token_cursor.h"
+
+using namespace std;
+using namespace boost::asio;
+
+//messages are "<producer> <sequence>" padded to a fixed size; sequence
+//counts per producer and sending client, so every receiver sees it grow
+//from each sender even when some messages went to other friends
+static string stress_message(size_t producer, uint64_t seq)
+{
+    string text = to_string(producer) + " " + to_string(seq) + " ";
+    text.resize(48, 'x');
+    return text;
+}
+
+//checks on the strand of one receiving client
+struct receiver
+{
+    unordered_map<string, uint64_t> next_seq;
+    atomic<uint64_t> *received;
+    atomic<uint64_t> *errors;
+
+    void operator()(string_view from, string_view text)
+    {
+        token_cursor tokens{text};
+        string_view producer = tokens.next();
+        uint64_t seq;
+        if (producer.empty() || !token_cursor::to_number(tokens.next(), &seq))
+        {
+            ++*errors;
+            return;
+        }
+        uint64_t &next = next_seq[string{from} + " " + string{producer}];
+        //a lost message leaves a gap only in the count, a duplicated or
+        //reordered one goes back
+        if (seq < next)
+        {
+            ++*errors;
+        }
+        next = seq + 1;
+        ++*received;
+    }
+};
+
+//many friend pairs and one client with many friends on one service run by
+//a thread pool, while producer threads write to every client and
+//heartbeats tick; every message must reach its friends once and in order;
+//meant to be built with -DENABLE_TSAN=ON too, where any report is a race
+//between strands
+//usage: strand_stress [pairs] [io_threads] [producers] [messages]
+//                     [hub_friends]
+int main(int argc, char *argv[])
+{
+    vector<size_t> args;
+    for (int i = 1; i < argc; ++i)
+    {
+        args.push_back(stoul(argv[i]));
+    }
+    size_t pairs = args.size() > 0 ? args[0] : 16;
+    size_t io_threads = args.size() > 1 ? args[1] :
+                        max<size_t>(4, thread::hardware_concurrency());
+    size_t producers = args.size() > 2 ? args[2] : 4;
+    //per producer, spread over all clients
+    size_t messages = args.size() > 3 ? args[3] : 20000;
+    size_t hub_friends = args.size() > 4 ? args[4] : 32;
+
+    local_server server;
+    uint16_t port = server.port();
+    quiet_clients();
+
+    io_service service{static_cast<int>(io_threads)};
+    io_service::work work{service};
+    vector<client::ptr> clients;
+    //friends of every client; active ones start after the passive ones
+    vector<vector<string>> friends;
+    vector<size_t> passive;
+    vector<size_t> active;
+    auto add = [&](const string &name, vector<string> friend_names)
+    {
+        (friend_names.empty() ? passive : active).push_back(clients.size());
+        clients.push_back(client::create(service, name, "127.0.0.1", port,
+                                         friend_names));
+        friends.push_back(move(friend_names));
+    };
+    for (size_t i = 0; i < pairs; ++i)
+    {
+        string passive_name = "p" + to_string(i);
+        add(passive_name, {});
+        add("a" + to_string(i), {passive_name});
+    }
+    vector<string> hub_names;
+    for (size_t i = 0; i < hub_friends; ++i)
+    {
+        hub_names.push_back("f" + to_string(i));
+        add(hub_names.back(), {});
+        friends.back().push_back("hub");
+    }
+    if (hub_friends > 0)
+    {
+        add("hub", hub_names);
+    }
+    for (size_t i = 0; i < pairs; ++i)
+    {
+        friends[2 * i].push_back("a" + to_string(i));
+    }
+
+    atomic<size_t> communicating{0};
+    atomic<uint64_t> received{0};
+    atomic<uint64_t> errors{0};
+    vector<receiver> receivers(clients.size());
+    send_buffer::options opts;
+    opts.policy = send_buffer::overflow_policy::block;
+    client::heartbeat_options heartbeat;
+    heartbeat.interval = boost::posix_time::milliseconds(20);
+    heartbeat.timeout = boost::posix_time::seconds(5);
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+        receivers[i].received = &received;
+        receivers[i].errors = &errors;
+        clients[i]->set_communication_handler([&communicating]
+                                              { ++communicating; });
+        clients[i]->set_message_handler(
+            [&r = receivers[i]](string_view from, string_view text)
+            { r(from, text); });
+        clients[i]->set_send_options(opts);
+        clients[i]->set_heartbeat(heartbeat);
+        //odd pairs run length-prefixed framing
+        clients[i]->set_binary_framing(i % 4 >= 2);
+    }
+
+    vector<thread> pool;
+    for (size_t i = 0; i < io_threads; ++i)
+    {
+        pool.emplace_back([&service]{ service.run(); });
+    }
+    //start hops onto the client strand from this thread
+    for (size_t i : passive)
+    {
+        clients[i]->start();
+    }
+    this_thread::sleep_for(std::chrono::milliseconds(100));
+    for (size_t i : active)
+    {
+        clients[i]->start();
+    }
+    //every link is reported on both of its ends; slow under ThreadSanitizer
+    size_t links = 2 * (pairs + hub_friends);
+    auto timeout = std::chrono::seconds{30};
+    bool connected = wait_for([&communicating, links]
+                              { return communicating == links; },
+                              timeout);
+    if (!connected)
+    {
+        printf("%zu of %zu links are communicating\n",
+               communicating.load(), links);
+    }
+
+    atomic<uint64_t> expected{0};
+    auto start = std::chrono::steady_clock::now();
+    vector<thread> writers;
+    for (size_t p = 0; p < producers && connected; ++p)
+    {
+        writers.emplace_back([p, messages, &clients, &friends, &expected]
+        {
+            vector<uint64_t> seq(clients.size());
+            for (size_t m = 0; m < messages; ++m)
+            {
+                size_t i = (m + p) % clients.size();
+                string text = stress_message(p, seq[i]++);
+                //every other message names one friend explicitly
+                if (m % 2 == 0)
+                {
+                    expected += friends[i].size();
+                    clients[i]->write(text);
+                }
+                else
+                {
+                    expected += 1;
+                    clients[i]->write(text,
+                                      friends[i][m % friends[i].size()]);
+                }
+            }
+        });
+    }
+    //stdin path of active clients, one producer for each of their rings
+    thread input{[producers, messages, connected, &clients, &friends,
+                  &active, &expected]
+    {
+        vector<uint64_t> seq(clients.size());
+        string line;
+        for (size_t m = 0; m < messages && connected; ++m)
+        {
+            size_t i = active[m % active.size()];
+            line = stress_message(producers, seq[i]++);
+            expected += friends[i].size();
+            while (!clients[i]->write_input(&line))
+            {
+                this_thread::yield();
+            }
+        }
+    }};
+    for (auto &w : writers)
+    {
+        w.join();
+    }
+    input.join();
+    bool done = connected && wait_for([&received, &expected]
+                                      { return received >= expected; },
+                                      timeout);
+    double seconds = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count();
+
+    printf("clients: %zu on %zu io threads, %zu producers, hub with %zu "
+           "friends\n", clients.size(), io_threads, producers, hub_friends);
+    printf("messages: %llu of %llu received, %llu out of order\n",
+           static_cast<unsigned long long>(received.load()),
+           static_cast<unsigned long long>(expected.load()),
+           static_cast<unsigned long long>(errors.load()));
+    printf("throughput: %.0f messages/s\n", received / seconds);
+
+    service.stop();
+    for (auto &t : pool)
+    {
+        t.join();
+    }
+    server.stop();
+    return done && received == expected && errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+#include "bench.h"
+#include "token_cursor.h"
+#include "command_table.h"
+
+using namespace std;
+
+//former client::get_token
+static string get_token(string *s)
+{
+    size_t space_index = s->find_first_of(' ');
+    size_t token_index = space_index == string::npos ? s->length() :
+                                                       space_index;
+
+    string res = s->substr(0, token_index);
+    if (token_index != s->length())
+    {
+        *s = s->substr(token_index + 1);
+    }
+    else
+    {
+        s->clear();
+    }
+    return res;
+}
+
+//walk the whole reply like handle_get_list does when friend is absent
+static size_t parse_get_token(const string &reply)
+{
+    string answer = reply;
+    size_t count = 0;
+    if (get_token(&answer) != "list")
+    {
+        return 0;
+    }
+    string cl;
+    while (!(cl = get_token(&answer)).empty())
+    {
+        count += cl == "friend";
+    }
+    return count;
+}
+
+static size_t parse_cursor(string_view reply)
+{
+    token_cursor tokens{reply};
+    size_t count = 0;
+    if (tokens.next() != "list")
+    {
+        return 0;
+    }
+    string_view cl;
+    while (!(cl = tokens.next()).empty())
+    {
+        count += cl == "friend";
+    }
+    return count;
+}
+
+//former handle_friend_command title checks
+static int dispatch_compare(string_view title)
+{
+    if (title == "message") return 1;
+    else if (title == "ping") return 2;
+    else if (title == "pong") return 3;
+    else if (title == "bulk") return 4;
+    else if (title == "bulk_end") return 5;
+    else if (title == "bulk_done") return 6;
+    return 0;
+}
+
+static int dispatch_table(string_view title)
+{
+    switch (to_verb(title))
+    {
+    case verb::message: return 1;
+    case verb::ping: return 2;
+    case verb::pong: return 3;
+    case verb::bulk: return 4;
+    case verb::bulk_end: return 5;
+    case verb::bulk_done: return 6;
+    default: return 0;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    //quadratic get_token takes too long on 100000 names by default
+    bool legacy_all = argc > 1 && strcmp(argv[1], "--legacy-all") == 0;
+
+    printf("%-10s %8s %14s %12s %12s\n",
+           "parser", "names", "ns/reply", "ns/name", "allocs/reply");
+    for (size_t names : {10, 1000, 100000})
+    {
+        string reply = "list";
+        for (size_t i = 0; i < names; ++i)
+        {
+            reply += " peer_" + to_string(i);
+        }
+
+        auto run = [&](const char *parser, auto parse)
+        {
+            size_t allocs_before = allocation_count();
+            size_t count = parse();
+            size_t allocs = allocation_count() - allocs_before;
+            do_not_optimize(count);
+
+            double ns = measure_ns([&]{ do_not_optimize(parse()); });
+            printf("%-10s %8zu %14.0f %12.2f %12zu\n", parser, names, ns,
+                   ns / names, allocs);
+        };
+
+        if (names <= 1000 || legacy_all)
+        {
+            run("get_token", [&]{ return parse_get_token(reply); });
+        }
+        run("cursor", [&]{ return parse_cursor(reply); });
+    }
+
+    //verbs in the order of the friend protocol, last ones cost the most
+    //string comparisons
+    const string_view titles[] = {"message", "bulk_done", "bulk", "unknown"};
+    printf("\n%-10s %10s %14s\n", "dispatch", "verb", "ns/title");
+    for (string_view title : titles)
+    {
+        string_view t = title;
+        double compare_ns = measure_ns(
+            [&]{ do_not_optimize(t); do_not_optimize(dispatch_compare(t)); });
+        double table_ns = measure_ns(
+            [&]{ do_not_optimize(t); do_not_optimize(dispatch_table(t)); });
+        printf("%-10s %10.*s %14.2f\n", "compare", int(title.size()),
+               title.data(), compare_ns);
+        printf("%-10s %10.*s %14.2f\n", "table", int(title.size()),
+               title.data(), table_ns);
+    }
+
+    return 0;
+}
@@ -1,14 +1,24 @@
 #include "client.h"
+#include "token_cursor.h"
+#include "local_addresses.h"
+#include "socket_options.h"
+#include "handler_memory.h"
+#include "command_table.h"
+#include "file_transfer.h"
+#include "friend_commands.h"
+#include "log_sink.h"
 
 #include <string>
-#include <array>
+#include <string_view>
 #include <vector>
 #include <memory>
 #include <functional>
+#include <initializer_list>
+#include <thread>
 #include <boost/asio.hpp>
 #include <boost/date_time.hpp>
 
-#include <iostream>
+#include <cstring>
 #include <utility>
 #include <algorithm>
 
@@ -18,73 +28,369 @@ using boost::asio::ip::tcp;
 using boost_error = boost::system::error_code;
 
 static const auto FRIEND_REPEAT_PERIOD = boost::posix_time::seconds(1);
+//server which keeps silent about watch or features doesn't know it
+static const auto OPTIONAL_ANSWER_TIMEOUT = boost::posix_time::seconds(2);
+//file data frame, friend reads frames up to its max line size
+static const size_t FILE_CHUNK_SIZE = 32 * 1024;
+//list answers longer than this are parsed before their line is complete
+static const size_t LIST_STREAM_SIZE = 4 * 1024;
 
-client::client(string name, string server_ip, uint16_t server_port,
-               string friend_name) :
+//pending part of the gathered write; asio keeps a copy of the buffer
+//sequence in the operation, so it must not own memory like vector does
+struct buffer_span
+{
+    using value_type = const_buffer;
+    using const_iterator = const const_buffer *;
+
+    const const_buffer *first;
+    const const_buffer *last;
+
+    const_iterator begin() const { return first; }
+    const_iterator end() const { return last; }
+};
+
+//options of activate and confirm_activation:
+//"framing=binary heartbeat name=<peer>"
+struct activation_options
+{
+    bool binary = false;
+    bool heartbeat = false;
+    string_view name;
+    //any option is given, so the friend isn't an old one
+    bool any = false;
+};
+
+static activation_options parse_activation(token_cursor *tokens)
+{
+    activation_options opts;
+    string_view token;
+    while (!(token = tokens->next()).empty())
+    {
+        opts.any = true;
+        if (token == "framing=binary")
+        {
+            opts.binary = true;
+        }
+        else if (token == "heartbeat")
+        {
+            opts.heartbeat = true;
+        }
+        else if (token.compare(0, 5, "name=") == 0)
+        {
+            opts.name = token.substr(5);
+        }
+    }
+    return opts;
+}
+
+//the same endpoints in any order
+static bool same_endpoints(const vector<connection_race::candidate> &a,
+                           const vector<connection_race::candidate> &b)
+{
+    return a.size() == b.size() &&
+           all_of(a.begin(), a.end(),
+               [&b](const connection_race::candidate &c)
+               {
+                   return any_of(b.begin(), b.end(),
+                       [&c](const connection_race::candidate &other)
+                       {
+                           return other.endpoint == c.endpoint;
+                       });
+               });
+}
+
+client::client(unique_ptr<io_service> own_service, io_service &service,
+               string name, string server_ip, uint16_t server_port,
+               vector<string> friend_names) :
+    own_service{move(own_service)},
+    service(service),
+    strand{service},
     server_socket{service},
     name{move(name)},
     server_endpoint{ip::address::from_string(server_ip), server_port},
-    friend_name{move(friend_name)},
+    friend_names{move(friend_names)},
     friend_repeat_timer{service},
+    watch_timer{service},
+    features_timer{service},
     acceptor{service}
 {
 }
 
 client::ptr client::create(string name, string server_ip, uint16_t server_port,
-                           string friend_name)
+                           vector<string> friend_names)
 {
-    client *p = new client{move(name), move(server_ip), server_port,
-                           move(friend_name)};
+    unique_ptr<io_service> own_service{new io_service};
+    io_service &service = *own_service;
+    client *p = new client{move(own_service), service, move(name),
+                           move(server_ip), server_port, move(friend_names)};
     return ptr{p};
 }
 
-void client::run()
+client::ptr client::create(io_service &service, string name,
+                           string server_ip, uint16_t server_port,
+                           vector<string> friend_names)
 {
-    server_socket.async_connect(server_endpoint,
-        [this](boost_error ec)
+    client *p = new client{nullptr, service, move(name), move(server_ip),
+                           server_port, move(friend_names)};
+    return ptr{p};
+}
+
+void client::run(size_t threads)
+{
+    start();
+    if (!own_service)
+    {
+        return;
+    }
+    vector<thread> pool;
+    for (size_t i = 1; i < threads; ++i)
+    {
+        pool.emplace_back([this]{ service.run(); });
+    }
+    service.run();
+    for (thread &t : pool)
+    {
+        t.join();
+    }
+}
+
+void client::start()
+{
+    //service may be run by other threads already
+    if (!strand.running_in_this_thread())
+    {
+        post(strand, [self = shared_from_this()]{ self->start(); });
+        return;
+    }
+
+    for (const string &f : friend_names)
+    {
+        add_peer(f);
+    }
+
+    boost_error ec;
+    server_socket.open(server_endpoint.protocol(), ec);
+    if (!ec)
+    {
+        share_local_port(server_socket, ec);
+    }
+    if (ec)
+    {
+        log_line{log_level::error} << "server socket open error: " <<
+                ec.message();
+        close_all();
+        return;
+    }
+
+    local_addresses::watch();
+    session_stamp.start();
+    auto connect_stamp = make_shared<metric_stamp>();
+    connect_stamp->start();
+    server_socket.async_connect(server_endpoint, bind_executor(strand,
+        [this, connect_stamp](boost_error ec)
         {
             if (!ec)
             {
+                connect_stamp->record(metric::server_connect);
                 open_connection();
             }
             else
             {
-                cout << "connection error: " << ec.message() << endl;
+                log_line{log_level::error} << "connection error: " <<
+                        ec.message();
                 close_all();
             }
         }
-    );
-    service.run();
+    ));
+}
+
+void client::write(const string &text, const string &to)
+{
+    if (!communicating)
+    {
+        log_line{log_level::warning} <<
+                "What are you doing man? I'm trying to connect.";
+        return;
+    }
+
+    //reused, so steady flow doesn't allocate
+    thread_local vector<peer_ptr> targets;
+    {
+        lock_guard<mutex> lock{peers_mutex};
+        collect_targets(to, &targets);
+    }
+    if (targets.empty())
+    {
+        log_line{log_level::warning} << "no communicating friend " << to;
+        return;
+    }
+    fan_out(text, targets, true);
+    targets.clear();
+}
+
+bool client::write_input(string *line)
+{
+    if (!communicating)
+    {
+        log_line{log_level::warning} <<
+                "What are you doing man? I'm trying to connect.";
+        return true;
+    }
+
+    if (!input_ring.push([line](string &slot){ slot.swap(*line); }))
+    {
+        return false;
+    }
+    line->clear();
+    //drain that is already posted takes this line as well
+    if (!input_wake.exchange(true))
+    {
+        post(strand, make_custom_alloc_handler(input_wake_memory,
+                     [self = shared_from_this()]{ self->drain_input(); }));
+    }
+    return true;
 }
 
-void client::write(const string &text)
+void client::drain_input()
 {
-    service.post(
-        [self = shared_from_this(), text]
+    //lines pushed after this point post the next drain
+    input_wake = false;
+    input_stalled = false;
+    if (closed)
+    {
+        return;
+    }
+
+    size_t message_size = name.size() + 16;
+    input_ring.consume(
+        [this, &message_size](string &line)
         {
-            if (self->state == state_type::communicate_friend)
+            string_view text = line;
+            string_view to;
+            if (!text.empty() && text.front() == '@')
             {
-                bool write_in_progress = !self->output_messages.empty();
-                string mes = "message " + self->name + " " + text + "\r\n";
-                self->output_messages.push(move(mes));
-                if (self->output_messages.size() > MAX_SAVED_OUTPUT_MESSAGES)
-                {
-                    cout << "<LOSTED MESSAGE>: " <<
-                            self->output_messages.front() << endl;
-                    self->output_messages.pop();
-                }
-                if (!write_in_progress)
+                size_t space = text.find(' ');
+                to = text.substr(1, space - 1);
+                text = space == string_view::npos ? string_view{} :
+                                                    text.substr(space + 1);
+            }
+            collect_targets(to, &input_targets);
+            if (input_targets.empty())
+            {
+                log_line{log_level::warning} << "no communicating friend " <<
+                        to;
+                return true;
+            }
+            if (text.empty())
+            {
+                input_targets.clear();
+                return true;
+            }
+
+            //block policy: leave lines in the ring, producer waits for it
+            for (const peer_ptr &p : input_targets)
+            {
+                if (p->output.would_block(message_size + text.size()))
                 {
-                    self->do_friend_write();
+                    input_targets.clear();
+                    input_stalled = true;
+                    return false;
                 }
             }
-            else
+            fan_out(text, input_targets, false);
+            input_targets.clear();
+            return true;
+        });
+    if (input_stalled)
+    {
+        //drained again when written messages are released
+        input_wake = true;
+    }
+}
+
+void client::send_file(const string &path, const string &to)
+{
+    post(strand, [self = shared_from_this(), path, to]
+        {
+            if (!self->communicating)
             {
-                cout << "What are you doing man? I'm trying to connect." <<
-                        endl;
+                log_line{log_level::warning} <<
+                        "What are you doing man? I'm trying to connect.";
+                return;
             }
-        }
-    );
+            self->collect_targets(to, &self->input_targets);
+            if (self->input_targets.empty())
+            {
+                log_line{log_level::warning} << "no communicating friend " <<
+                        to;
+            }
+            for (const peer_ptr &p : self->input_targets)
+            {
+                self->start_file_send(p, path);
+            }
+            self->input_targets.clear();
+        });
+}
+
+void client::set_send_options(const send_buffer::options &opts)
+{
+    send_options = opts;
+}
+
+void client::set_watermark_handlers(function<void()> high, function<void()> low)
+{
+    high_handler = move(high);
+    low_handler = move(low);
+}
+
+void client::set_binary_framing(bool offer)
+{
+    offer_binary_framing = offer;
+}
+
+void client::set_link_bench(const link_bench::options &opts)
+{
+    bench_options = opts;
+}
+
+void client::set_peer_cache(const string &path,
+                            boost::posix_time::time_duration ttl)
+{
+    peer_cache_path = path;
+    peer_cache_ttl = ttl;
+}
+
+void client::set_heartbeat(const heartbeat_options &opts)
+{
+    heartbeat = opts;
+}
+
+void client::set_race_options(const connection_race::options &opts,
+                              unsigned predicted_ports)
+{
+    race_options = opts;
+    this->predicted_ports = predicted_ports;
+}
+
+void client::set_communication_handler(function<void()> handler)
+{
+    communication_handler = move(handler);
+}
+
+void client::set_close_handler(function<void()> handler)
+{
+    close_handler = move(handler);
+}
+
+void client::set_message_handler(
+        function<void(string_view, string_view)> handler)
+{
+    message_handler = move(handler);
+}
+
+void client::set_bench_handler(function<void(bool)> handler)
+{
+    bench_handler = move(handler);
 }
 
 void client::open_connection()
@@ -94,373 +400,1899 @@ void client::open_connection()
     {
         return;
     }
+    punch_cached();
     send_connect();
+    //server handles requests in order, so friends are looked up in the
+    //round trip of the registration
+    for (auto &entry : peers)
+    {
+        send_get_info(entry.second);
+    }
+    do_server_read();
 }
 
-void client::send_connect()
+client::peer_ptr client::add_peer(string peer_name)
 {
-    server_buf = "connect " + name + " " + to_string(private_endpoint) + "\r\n";
-    async_write(server_socket, buffer(server_buf),
-        [this](boost_error ec, size_t)
+    peer_ptr p = make_shared<peer>(service);
+    p->name = move(peer_name);
+    //names are tokens, a key with space never matches one
+    p->key = p->name.empty() ? " " + std::to_string(++nameless_peers) :
+                               p->name;
+    p->output.configure(send_options);
+    //producers pause while any friend is slow
+    p->output.set_watermark_handlers(
+        [this]
         {
-            if (!ec)
+            if (high_peers++ == 0 && high_handler)
             {
-                start_read(&client::handle_connect);
+                high_handler();
             }
-            else
+        },
+        [this]
+        {
+            if (--high_peers == 0 && low_handler)
+            {
+                low_handler();
+            }
+        });
+    p->bench.configure(bench_options);
+    p->state_stamp.start();
+
+    lock_guard<mutex> lock{peers_mutex};
+    peers[p->key] = p;
+    return p;
+}
+
+client::peer_ptr client::find_peer(string_view peer_name)
+{
+    auto it = peers.find(peer_name);
+    return it != peers.end() ? it->second : nullptr;
+}
+
+void client::collect_targets(string_view to, vector<peer_ptr> *targets)
+{
+    if (!to.empty())
+    {
+        peer_ptr p = find_peer(to);
+        if (p && p->communicating)
+        {
+            targets->push_back(move(p));
+        }
+        return;
+    }
+    for (auto &entry : peers)
+    {
+        if (entry.second->communicating)
+        {
+            targets->push_back(entry.second);
+        }
+    }
+}
+
+void client::change_state(const peer_ptr &p, state_type new_state)
+{
+    if (p->state == state_type::wait_friend)
+    {
+        p->state_stamp.record(metric::wait_friend_state);
+    }
+    else if (p->state == state_type::connect_friend)
+    {
+        p->state_stamp.record(metric::connect_friend_state);
+    }
+    p->state_stamp.start();
+    p->state = new_state;
+}
+
+const char *client::label(const peer_ptr &p)
+{
+    return p->name.empty() ? "friend" : p->name.c_str();
+}
+
+void client::send_request(string request, answer_handler handler, peer_ptr p,
+                          verb optional)
+{
+    uint32_t id = 0;
+    if (server_ids)
+    {
+        //zero is kept for untagged requests
+        id = ++last_request_id == 0 ? ++last_request_id : last_request_id;
+        request.insert(0, "#" + std::to_string(id) + " ");
+    }
+    server_requests.push_back({handler, move(p), {}, id, optional});
+    server_requests.back().stamp.start();
+    bool write_in_progress = !server_output.empty();
+    server_output.push_back(move(request));
+    if (!write_in_progress)
+    {
+        do_server_write();
+    }
+}
+
+void client::do_server_write()
+{
+    //requests queued while the previous write was in flight go together;
+    //deque keeps their strings in place while more are queued
+    server_write_buffers.clear();
+    for (const string &request : server_output)
+    {
+        server_write_buffers.push_back(buffer(request));
+    }
+    const const_buffer *first = server_write_buffers.data();
+    async_write(server_socket,
+        buffer_span{first, first + server_write_buffers.size()},
+        bind_executor(strand,
+        [this, count = server_write_buffers.size()](boost_error ec, size_t)
+        {
+            if (ec)
             {
-                cout << "connect error: " << ec.message() << endl;
+                log_line{log_level::error} << "write to server error: " <<
+                        ec.message();
                 close_all();
+                return;
+            }
+            server_output.erase(server_output.begin(),
+                                server_output.begin() + count);
+            if (!server_output.empty())
+            {
+                do_server_write();
             }
         }
-    );
+    ));
+}
+
+void client::do_server_read()
+{
+    string_view answer;
+    while (server_framer.next_line(&answer))
+    {
+        handle_server_line(answer);
+        if (closed)
+        {
+            return;
+        }
+    }
+    stream_list_answer();
+    if (server_framer.overflow())
+    {
+        log_line{log_level::error} << "server answer is too long";
+        close_all();
+        return;
+    }
+
+    server_socket.async_read_some(server_framer.prepare(),
+        bind_executor(strand, make_custom_alloc_handler(server_read_memory,
+        [self = shared_from_this()](boost_error ec, size_t bytes)
+        {
+            if (ec)
+            {
+                if (!self->closed)
+                {
+                    log_line{log_level::error} << "read from server error: " <<
+                            ec.message();
+                }
+                self->close_all();
+                return;
+            }
+            self->server_framer.commit(bytes);
+            self->do_server_read();
+        }
+    )));
+}
+
+void client::stream_list_answer()
+{
+    string_view head = server_framer.partial_line();
+    if (!list_streaming)
+    {
+        if (head.size() < LIST_STREAM_SIZE)
+        {
+            return;
+        }
+        token_cursor tokens{head};
+        string_view first = tokens.next();
+        uint32_t id = 0;
+        if (!first.empty() && first[0] == '#')
+        {
+            token_cursor::to_number(first.substr(1), &id);
+            first = tokens.next();
+        }
+        if (to_verb(first) != verb::list ||
+            !take_request(id, verb::list, &list_request))
+        {
+            return;
+        }
+        list_streaming = true;
+        //keep the separator, the framer would skip a line end at the front
+        server_framer.consume_partial(head.size() - tokens.rest().size() - 1);
+        head = server_framer.partial_line();
+    }
+
+    //only whole names, the last one may be cut
+    size_t last_space = head.rfind(' ');
+    if (last_space == string_view::npos || last_space == 0)
+    {
+        return;
+    }
+    token_cursor names{head.substr(0, last_space)};
+    look_up_listed(&names);
+    server_framer.consume_partial(last_space);
+}
+
+void client::handle_server_line(string_view line)
+{
+    //the rest of a streamed list is only names
+    if (list_streaming)
+    {
+        list_streaming = false;
+        token_cursor names{line};
+        (this->*list_request.handler)(verb::list, &names, list_request);
+        return;
+    }
+
+    token_cursor tokens{line};
+    string_view first = tokens.next();
+    uint32_t id = 0;
+    if (!first.empty() && first[0] == '#')
+    {
+        //its request would wait forever and the rest can't be trusted
+        if (!token_cursor::to_number(first.substr(1), &id) || id == 0)
+        {
+            log_line{log_level::error} << "invalid server answer id: " <<
+                    line;
+            close_all();
+            return;
+        }
+        first = tokens.next();
+    }
+    verb title = to_verb(first);
+    //friend registration events come between the answers
+    if (title == verb::online)
+    {
+        handle_online(&tokens);
+        return;
+    }
+
+    server_request request;
+    if (!take_request(id, title, &request))
+    {
+        log_line{log_level::warning} << "unexpected server answer: " << line;
+        return;
+    }
+    (this->*request.handler)(title, &tokens, request);
+}
+
+void client::drop_requests(answer_handler handler)
+{
+    //the next untagged answer goes to its own request then; a late tagged
+    //answer only matches nothing
+    server_requests.erase(
+        remove_if(server_requests.begin(), server_requests.end(),
+            [handler](const server_request &r)
+            {
+                return r.handler == handler;
+            }),
+        server_requests.end());
+}
+
+bool client::take_request(uint32_t id, verb title, server_request *request)
+{
+    while (true)
+    {
+        //answers mostly come in order, so the match is near the front
+        auto it = find_if(server_requests.begin(), server_requests.end(),
+            [id](const server_request &r){ return r.id == id; });
+        if (it == server_requests.end())
+        {
+            return false;
+        }
+        *request = move(*it);
+        server_requests.erase(it);
+        if (request->optional == verb::unknown ||
+            title == request->optional || title == verb::error)
+        {
+            return true;
+        }
+        //server which doesn't know an optional request skips it silently,
+        //so the answer belongs to a later one; the skipped one falls back
+        token_cursor none{string_view{}};
+        (this->*request->handler)(verb::unknown, &none, *request);
+    }
+}
+
+void client::send_connect()
+{
+    //the form every server parses, extensions are asked for separately
+    send_request("connect " + name + " " + to_string(private_endpoint) +
+                 "\r\n", &client::handle_connect);
+    //older server answers error or keeps silent, pipelined requests go
+    //untagged until the answer
+    send_request("features ids list_filters addresses\r\n",
+                 &client::handle_features, nullptr, verb::features);
+    features_timer.expires_from_now(OPTIONAL_ANSWER_TIMEOUT);
+    features_timer.async_wait(bind_executor(strand,
+        [this](boost_error ec)
+        {
+            if (ec || closed)
+            {
+                return;
+            }
+            drop_requests(&client::handle_features);
+            log_line{log_level::warning} <<
+                    "server doesn't answer features, using the base protocol";
+        }
+    ));
+}
+
+void client::handle_features(verb answer, token_cursor *tokens,
+                             const server_request &)
+{
+    features_timer.cancel();
+    if (answer != verb::features)
+    {
+        log_line{log_level::debug} << "server has no protocol extensions";
+        return;
+    }
+
+    bool addresses = false;
+    string_view token;
+    while (!(token = tokens->next()).empty())
+    {
+        server_ids = server_ids || token == "ids";
+        server_list_filters = server_list_filters || token == "list_filters";
+        addresses = addresses || token == "addresses";
+    }
+    //friend may reach us by any other local address on the same port; the
+    //registration is repeated with them
+    string extra;
+    for (const ip::address &a : private_addresses)
+    {
+        if (a != private_endpoint.address())
+        {
+            extra += " " + a.to_string();
+        }
+    }
+    if (addresses && !extra.empty())
+    {
+        send_request("connect " + name + " " + to_string(private_endpoint) +
+                     extra + "\r\n", &client::handle_addresses);
+    }
+}
+
+void client::handle_addresses(verb answer, token_cursor *,
+                              const server_request &)
+{
+    if (answer != verb::confirm_connection)
+    {
+        log_line{log_level::warning} <<
+                "server didn't take private addresses: " << verb_name(answer);
+    }
+}
+
+void client::handle_connect(verb answer, token_cursor *,
+                            const server_request &request)
+{
+    request.stamp.record(metric::connect_answer);
+    if (answer == verb::confirm_connection)
+    {
+        //friends which weren't registered yet when get_info was pipelined
+        if (is_active_client())
+        {
+            send_get_list();
+        }
+    }
+    else
+    {
+        log_line{log_level::warning} << "inalid answer for \"connect\": " <<
+                verb_name(answer);
+        close_all();
+    }
+}
+
+void client::send_get_list()
+{
+    //one list serves every friend which is not looked up yet
+    if (friends_to_look_up() == 0)
+    {
+        return;
+    }
+    string request = "get_list";
+    //answer doesn't grow with the registry when only friends are listed
+    if (server_list_filters)
+    {
+        for (auto &entry : peers)
+        {
+            const peer_ptr &p = entry.second;
+            if (p->state == state_type::wait_friend && !p->lookup_pending)
+            {
+                request += " name=" + p->name;
+            }
+        }
+    }
+    request += "\r\n";
+    send_request(move(request), &client::handle_get_list);
+}
+
+size_t client::friends_to_look_up() const
+{
+    return count_if(peers.begin(), peers.end(),
+        [](const auto &entry)
+        {
+            return entry.second->state == state_type::wait_friend &&
+                   !entry.second->lookup_pending;
+        });
+}
+
+void client::look_up_listed(token_cursor *tokens)
+{
+    size_t missing = friends_to_look_up();
+    string_view cl;
+    while (missing > 0 && !(cl = tokens->next()).empty())
+    {
+        peer_ptr p = find_peer(cl);
+        if (p && p->state == state_type::wait_friend && !p->lookup_pending)
+        {
+            send_get_info(p);
+            --missing;
+        }
+    }
+}
+
+void client::handle_get_list(verb answer, token_cursor *tokens,
+                             const server_request &request)
+{
+    request.stamp.record(metric::get_list_answer);
+    if (answer != verb::list)
+    {
+        log_line{log_level::warning} << "get_list invalid answer";
+        close_all();
+        return;
+    }
+
+    look_up_listed(tokens);
+
+    bool poll = false;
+    for (auto &entry : peers)
+    {
+        const peer_ptr &p = entry.second;
+        if (p->state != state_type::wait_friend || p->lookup_pending ||
+            p->watched)
+        {
+            continue;
+        }
+        if (watch_supported)
+        {
+            send_watch(p);
+        }
+        else
+        {
+            poll = true;
+        }
+    }
+    if (poll)
+    {
+        schedule_get_list();
+    }
+}
+
+void client::schedule_get_list()
+{
+    if (get_list_scheduled || closed)
+    {
+        return;
+    }
+    get_list_scheduled = true;
+    friend_repeat_timer.expires_from_now(FRIEND_REPEAT_PERIOD);
+    friend_repeat_timer.async_wait(bind_executor(strand,
+        [this](boost_error ec)
+        {
+            get_list_scheduled = false;
+            if (!ec)
+            {
+                send_get_list();
+            }
+            else if (ec != error::operation_aborted)
+            {
+                log_line{log_level::error} << "repeat timer error: " <<
+                        ec.message();
+                close_all();
+            }
+        }
+    ));
+}
+
+void client::send_watch(const peer_ptr &p)
+{
+    p->watched = true;
+    send_request("watch " + p->name + "\r\n", &client::handle_watch, p,
+                 verb::watching);
+    if (watch_requests++ == 0)
+    {
+        start_watch_timer();
+    }
+}
+
+void client::start_watch_timer()
+{
+    watch_timer.expires_from_now(OPTIONAL_ANSWER_TIMEOUT);
+    watch_timer.async_wait(bind_executor(strand,
+        [this](boost_error ec)
+        {
+            if (ec || closed || watch_requests == 0)
+            {
+                return;
+            }
+            drop_requests(&client::handle_watch);
+            watch_requests = 0;
+            log_line{log_level::warning} <<
+                    "server doesn't answer watch, polling friend list";
+            poll_friends();
+        }
+    ));
+}
+
+void client::poll_friends()
+{
+    watch_supported = false;
+    for (auto &entry : peers)
+    {
+        entry.second->watched = false;
+    }
+    schedule_get_list();
+}
+
+void client::handle_watch(verb answer, token_cursor *tokens,
+                          const server_request &request)
+{
+    request.stamp.record(metric::watch_answer);
+    //the rest still have the whole timeout from this answer
+    if (--watch_requests == 0)
+    {
+        watch_timer.cancel();
+    }
+    else
+    {
+        start_watch_timer();
+    }
+
+    const peer_ptr &p = request.p;
+    if (answer != verb::watching || tokens->next() != p->name)
+    {
+        log_line{log_level::warning} <<
+                "server doesn't support watch, polling friend list";
+        poll_friends();
+        return;
+    }
+
+    //server tells as soon as friend is registered
+    p->online_stamp.start();
+}
+
+void client::handle_online(token_cursor *tokens)
+{
+    peer_ptr p = find_peer(tokens->next());
+    if (!p || !p->watched)
+    {
+        return;
+    }
+
+    p->online_stamp.record(metric::online_wait);
+    p->watched = false;
+    send_get_info(p);
+}
+
+void client::send_get_info(const peer_ptr &p)
+{
+    if (p->state != state_type::wait_friend || p->lookup_pending)
+    {
+        return;
+    }
+
+    p->lookup_pending = true;
+    send_request("get_info " + p->name + "\r\n", &client::handle_get_info, p);
+}
+
+void client::handle_get_info(verb answer, token_cursor *tokens,
+                             const server_request &request)
+{
+    request.stamp.record(metric::get_info_answer);
+    const peer_ptr &p = request.p;
+    p->lookup_pending = false;
+    if (answer == verb::error)
+    {
+        //friend isn't registered yet, list or watch waits for it
+        send_get_list();
+        return;
+    }
+    if (answer != verb::info)
+    {
+        log_line{log_level::warning} << "get_info " << label(p) <<
+                " invalid answer title";
+        send_get_list();
+        return;
+    }
+
+    if (p->state != state_type::wait_friend)
+    {
+        return;
+    }
+
+    tcp::endpoint private_endpoint;
+    tcp::endpoint public_endpoint;
+    if (!parse_endpoint(tokens, &private_endpoint) ||
+        !parse_endpoint(tokens, &public_endpoint))
+    {
+        log_line{log_level::warning} << "get_info " << label(p) <<
+                " invalid endpoints";
+        send_get_list();
+        return;
+    }
+
+    //friend private endpoint first, the same network is the fastest path,
+    //then the public one, other friend addresses and predicted NAT ports
+    vector<connection_race::candidate> candidates;
+    auto add = [&candidates](tcp::endpoint endpoint, string kind)
+    {
+        //without NAT public endpoint is the private one
+        for (const connection_race::candidate &c : candidates)
+        {
+            if (c.endpoint == endpoint)
+            {
+                return;
+            }
+        }
+        candidates.push_back({endpoint, move(kind)});
+    };
+    add(private_endpoint, "private");
+    add(public_endpoint, "public");
+    string_view token;
+    while (!(token = tokens->next()).empty())
+    {
+        boost_error ec;
+        ip::address address = ip::make_address(token, ec);
+        if (!ec)
+        {
+            add(tcp::endpoint{address, private_endpoint.port()}, "private");
+        }
+    }
+    for (unsigned i = 1; i <= predicted_ports &&
+                         public_endpoint.port() + i <= 0xffff; ++i)
+    {
+        add(tcp::endpoint{public_endpoint.address(),
+                          static_cast<uint16_t>(public_endpoint.port() + i)},
+            "predicted");
+    }
+    //optimistic race already punches the endpoints server tells
+    if (p->cached_race && same_endpoints(p->candidates, candidates))
+    {
+        p->cached_race = false;
+        return;
+    }
+    p->cached_race = false;
+    p->candidates = candidates;
+    race_friend(p, move(candidates));
+}
+
+void client::race_friend(const peer_ptr &p,
+                         vector<connection_race::candidate> candidates)
+{
+    if (p->race)
+    {
+        p->race->cancel();
+    }
+
+    p->private_connect_stamp.start();
+    p->public_connect_stamp.start();
+    //friend was told about the acceptor port, NAT must map the same one
+    race_options.local_port = private_endpoint.port();
+    p->race = connection_race::create(strand, move(candidates),
+                                      race_options);
+    p->race->start(
+        [this, p](socket_ptr s, const connection_race::candidate &winner,
+                  const connection_race::attempt &a)
+        {
+            if (winner.kind == "private")
+            {
+                p->private_connect_stamp.record(metric::private_connect);
+            }
+            else
+            {
+                p->public_connect_stamp.record(metric::public_connect);
+            }
+            log_line{} << "communication with " << label(p) <<
+                    " started on " << winner.kind <<
+                    " endpoint " << to_string(winner.endpoint) <<
+                    " (attempt " << a.number << ", " <<
+                    p->race->attempts() << " total)";
+            activate_commutation(s, p, winner.kind);
+        },
+        [p](const connection_race::candidate &c,
+            const connection_race::attempt &a)
+        {
+            if (metrics::enabled())
+            {
+                metrics::record(metric::punch_attempt,
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            a.elapsed).count());
+            }
+            log_line{log_level::error} << label(p) << " " << c.kind <<
+                    " connection to " <<
+                    to_string(c.endpoint) << " attempt " << a.number <<
+                    " error after " <<
+                    std::chrono::duration<double, milli>(a.elapsed).count() <<
+                    " ms: " << a.ec.message();
+        },
+        [this, p]
+        {
+            if (p->cached_race)
+            {
+                drop_cached(p, "unreachable");
+                return;
+            }
+            log_line{log_level::warning} << "no endpoint of " << label(p) <<
+                    " is reachable";
+            schedule_get_list();
+        }
+    );
+}
+
+void client::punch_cached()
+{
+    if (peer_cache_path.empty())
+    {
+        return;
+    }
+    string error;
+    if (!endpoint_cache.open(peer_cache_path, &error))
+    {
+        log_line{log_level::warning} << "peer cache " << peer_cache_path <<
+                " error: " << error;
+        return;
+    }
+
+    uint64_t ttl = peer_cache_ttl.total_seconds();
+    for (auto &entry : peers)
+    {
+        const peer_ptr &p = entry.second;
+        peer_cache::entry cached;
+        if (p->state != state_type::wait_friend ||
+            !endpoint_cache.find(name, p->name, ttl, &cached))
+        {
+            continue;
+        }
+
+        //the last winner first, the rest in order of get_info
+        vector<connection_race::candidate> candidates;
+        auto add = [&candidates](const tcp::endpoint &endpoint, string kind)
+        {
+            if (endpoint.port() == 0)
+            {
+                return;
+            }
+            for (const connection_race::candidate &c : candidates)
+            {
+                if (c.endpoint == endpoint)
+                {
+                    return;
+                }
+            }
+            candidates.push_back({endpoint, move(kind)});
+        };
+        add(cached.winner, cached.path);
+        add(cached.private_endpoint, "private");
+        add(cached.public_endpoint, "public");
+        if (candidates.empty())
+        {
+            continue;
+        }
+
+        log_line{} << "punching " << label(p) << " from cache (" <<
+                peer_cache::unix_now() - cached.unix_time << " s old)";
+        p->candidates = candidates;
+        p->cached_race = true;
+        race_friend(p, move(candidates));
+    }
+}
+
+void client::drop_cached(const peer_ptr &p, const char *reason)
+{
+    log_line{log_level::warning} << "cached endpoints of " << label(p) <<
+            " are stale (" << reason << ")";
+    p->cached_race = false;
+    p->candidates.clear();
+    endpoint_cache.erase(name, p->name);
+}
+
+void client::cache_endpoints(const peer_ptr &p, const string &path)
+{
+    boost_error ec;
+    peer_cache::entry cached;
+    cached.winner = p->socket->remote_endpoint(ec);
+    if (ec)
+    {
+        return;
+    }
+    cached.path = path;
+    for (const connection_race::candidate &c : p->candidates)
+    {
+        if (c.kind == "private" && cached.private_endpoint.port() == 0)
+        {
+            cached.private_endpoint = c.endpoint;
+        }
+        else if (c.kind == "public" && cached.public_endpoint.port() == 0)
+        {
+            cached.public_endpoint = c.endpoint;
+        }
+    }
+    endpoint_cache.store(name, p->name, cached);
+}
+
+void client::activate_commutation(socket_ptr s, peer_ptr p,
+                                  const string &path)
+{
+    if (p)
+    {
+        if (p->state != state_type::wait_friend)
+        {
+            return;
+        }
+        change_state(p, state_type::connect_friend);
+        p->activation_stamp.start();
+        //friend has connected to us first, drop attempts still in flight
+        if (p->race)
+        {
+            p->race->cancel();
+        }
+        //cached endpoint may be taken by another program by now
+        if (p->cached_race)
+        {
+            p->link_timer.expires_from_now(race_options.deadline);
+            p->link_timer.async_wait(bind_executor(strand,
+                [this, p, s](boost_error ec)
+                {
+                    if (ec || p->state != state_type::connect_friend)
+                    {
+                        return;
+                    }
+                    retry_activation(p, s, "no activation");
+                }
+            ));
+        }
+    }
+
+    framer_ptr framer = make_shared<line_framer>();
+    auto handler =
+        [self = shared_from_this(), s, p, framer, path]
+        (boost_error ec, string_view answer)
+        {
+            if (ec)
+            {
+                //friend went away before confirming, look it up again
+                if (p && p->state == state_type::connect_friend)
+                {
+                    log_line{log_level::warning} << "activation of " <<
+                            self->label(p) << " failed: " << ec.message();
+                    self->retry_activation(p, s, "activation failed");
+                }
+                return;
+            }
+
+            token_cursor tokens{answer};
+            if (to_verb(tokens.next()) != verb::confirm_activation)
+            {
+                log_line{log_level::warning} <<
+                        "invalid confirm activation command";
+                s->close();
+                if (p)
+                {
+                    self->close_peer(p);
+                }
+                return;
+            }
+
+            //friend of accepted socket is known by the confirmation only
+            activation_options opts = parse_activation(&tokens);
+            peer_ptr target = p ? p : opts.name.empty() ? nullptr :
+                                      self->find_peer(opts.name);
+            if (!target || target->state == state_type::communicate_friend ||
+                target->state == state_type::closed)
+            {
+                s->close();
+                return;
+            }
+            if (target->state == state_type::wait_friend)
+            {
+                self->change_state(target, state_type::connect_friend);
+                target->activation_stamp.start();
+                if (target->race)
+                {
+                    target->race->cancel();
+                }
+            }
+            target->binary_framing = self->offer_binary_framing && opts.binary;
+            target->heartbeat = !self->heartbeat.interval.is_zero() &&
+                                opts.heartbeat;
+            self->start_commutation(target, s, framer, path);
+        };
+
+    auto buf = make_shared<string>();
+    //old friends know only plain "activate", so options are opt-in; the
+    //name goes with them, or when the friend of accepted socket is known
+    //by its confirmation only
+    *buf = "activate";
+    if (offer_binary_framing)
+    {
+        *buf += " framing=binary";
+    }
+    if (!heartbeat.interval.is_zero())
+    {
+        *buf += " heartbeat";
+    }
+    if (offer_binary_framing || !heartbeat.interval.is_zero() || !p)
+    {
+        *buf += " name=" + name;
+    }
+    *buf += "\r\n";
+    async_write(*s, buffer(*buf), bind_executor(strand,
+        [self = shared_from_this(), s, p, framer, buf, handler]
+        (boost_error ec, size_t)
+        {
+            if (!ec)
+            {
+                self->read_line(*s, *framer, self->handshake_memory, handler);
+            }
+            else
+            {
+                log_line{log_level::error} << "write activate error";
+                if (p)
+                {
+                    self->close_peer(p);
+                }
+            }
+        }
+    ));
+}
+
+void client::retry_activation(const peer_ptr &p, const socket_ptr &s,
+                              const char *reason)
+{
+    boost_error ec;
+    s->close(ec);
+    p->link_timer.cancel();
+    change_state(p, state_type::wait_friend);
+    if (p->cached_race)
+    {
+        drop_cached(p, reason);
+    }
+    send_get_info(p);
+}
+
+void client::accept_activation(socket_ptr s)
+{
+    available_sockets.push_back(s);
+    framer_ptr framer = make_shared<line_framer>();
+
+    auto send_confirm =
+        [self = shared_from_this(), s, buf = make_shared<string>()]
+        (bool options, bool binary, bool heartbeat)
+        {
+            //old friend sends plain "activate" and expects plain answer
+            *buf = "confirm_activation";
+            if (binary)
+            {
+                *buf += " framing=binary";
+            }
+            if (heartbeat)
+            {
+                *buf += " heartbeat";
+            }
+            if (options)
+            {
+                *buf += " name=" + self->name;
+            }
+            *buf += "\r\n";
+            async_write(*s, buffer(*buf), bind_executor(self->strand,
+                [self, s, buf](boost_error ec, size_t)
+                {
+                    if (ec)
+                    {
+                        log_line{log_level::error} <<
+                                "write activation confirm error";
+                        s->close();
+                    }
+                }
+            ));
+        };
+
+    auto handler =
+        [self = shared_from_this(), s, framer, send_confirm]
+        (boost_error ec, string_view answer)
+        {
+            self->drop_available(s);
+            if (ec)
+            {
+                return;
+            }
+
+            token_cursor tokens{answer};
+            if (to_verb(tokens.next()) != verb::activate)
+            {
+                log_line{log_level::warning} << "invalid activate command";
+                s->close();
+                return;
+            }
+
+            //friend offers binary framing, accept it
+            activation_options opts = parse_activation(&tokens);
+            //friends which don't tell their names get own entries
+            peer_ptr p = opts.name.empty() ? nullptr :
+                                             self->find_peer(opts.name);
+            if (p && p->state == state_type::communicate_friend)
+            {
+                if (!p->heartbeat)
+                {
+                    log_line{log_level::warning} << label(p) <<
+                            " is already connected";
+                    s->close();
+                    return;
+                }
+                //friend punches again only after it gave up the old link
+                self->link_lost(p, "friend reconnects");
+            }
+            //friend which lost its link keeps the entry
+            if (!p || p->state == state_type::closed)
+            {
+                p = self->add_peer(string{opts.name});
+            }
+            p->link_timer.cancel();
+            p->binary_framing = opts.binary;
+            p->heartbeat = !self->heartbeat.interval.is_zero() &&
+                           opts.heartbeat;
+            send_confirm(opts.any, p->binary_framing, p->heartbeat);
+            self->start_commutation(p, s, framer, "accepted");
+        };
+
+    read_line(*s, *framer, handshake_memory, handler);
+}
+
+void client::drop_available(const socket_ptr &s)
+{
+    auto it = find(available_sockets.begin(), available_sockets.end(), s);
+    if (it != available_sockets.end())
+    {
+        available_sockets.erase(it);
+    }
+}
+
+void client::start_commutation(const peer_ptr &p, socket_ptr s,
+                               framer_ptr framer, const string &path)
+{
+    p->socket = s;
+    p->path = path;
+    //keep bytes which friend sent right after activation
+    p->framer = move(*framer);
+    change_state(p, state_type::communicate_friend);
+    p->activation_stamp.record(metric::activation);
+    if (p->recovering)
+    {
+        p->recovery_stamp.record(metric::link_recovery);
+    }
+    else
+    {
+        session_stamp.record(metric::time_to_communicate);
+    }
+    p->communicating = true;
+    communicating = true;
+    p->last_receive_ns = p->last_send_ns = metrics::now();
+    if (endpoint_cache.is_open() && path != "accepted")
+    {
+        cache_endpoints(p, path);
+    }
+    p->cached_race = false;
+    //friends without heartbeats keep the system TCP timeouts
+    if (p->heartbeat)
+    {
+        boost_error ec;
+        detect_dead_peer(*s, heartbeat.timeout.total_milliseconds(), ec);
+        if (ec)
+        {
+            log_line{log_level::warning} << "keepalive of " << label(p) <<
+                    " error: " << ec.message();
+        }
+    }
+
+    log_line{} << "communication with " << label(p) << " started" <<
+            (p->binary_framing ? " with binary framing" : "") <<
+            (p->heartbeat ? " and heartbeats" : "");
+    if (communication_handler && !p->recovering)
+    {
+        communication_handler();
+    }
+    p->recovering = false;
+    do_friend_read(p);
+    //messages queued before the link was lost
+    do_friend_write(p);
+    if (p->heartbeat)
+    {
+        schedule_heartbeat(p);
+    }
+    if (is_active_client() && p->bench.enabled())
+    {
+        start_link_bench(p);
+    }
+}
+
+void client::do_friend_read(const peer_ptr &p)
+{
+    if (p->binary_framing)
+    {
+        uint8_t type;
+        string_view payload;
+        while (p->framer.next_frame(&type, &payload))
+        {
+            if (!handle_friend_frame(p, type, payload))
+            {
+                return;
+            }
+        }
+    }
+    else
+    {
+        string_view message;
+        while (p->framer.next_line(&message))
+        {
+            if (!handle_friend_message(p, message))
+            {
+                return;
+            }
+        }
+    }
+    if (p->framer.overflow())
+    {
+        log_line{log_level::warning} << "too long message from " << label(p);
+        close_peer(p);
+        return;
+    }
+
+    auto handler = bind_executor(strand,
+        make_custom_alloc_handler(p->read_memory,
+        [self = shared_from_this(), p, s = p->socket]
+        (boost_error ec, size_t bytes)
+        {
+            //completion of a link which is already replaced
+            if (s != p->socket)
+            {
+                return;
+            }
+            if (!ec)
+            {
+                p->last_receive_ns = metrics::now();
+                p->framer.commit(bytes);
+                self->do_friend_read(p);
+            }
+            else if (ec == error::eof)
+            {
+                log_line{log_level::error} << "read from " << label(p) <<
+                        " error: " << ec.message();
+                self->close_peer(p);
+            }
+            else
+            {
+                self->link_lost(p, "read error: " + ec.message());
+            }
+        }));
+
+    //rest of a partially received frame is read at once
+    size_t needed = p->framer.frame_bytes_needed();
+    if (p->binary_framing && needed > 1)
+    {
+        async_read(*p->socket, buffer(p->framer.prepare(needed), needed),
+                   handler);
+    }
+    else
+    {
+        p->socket->async_read_some(p->framer.prepare(), handler);
+    }
+}
+
+bool client::handle_friend_message(const peer_ptr &p, string_view message)
+{
+    token_cursor tokens{message};
+    return handle_friend_command(p, to_verb(tokens.next()), &tokens);
+}
+
+bool client::handle_friend_frame(const peer_ptr &p, uint8_t type,
+                                 string_view payload)
+{
+    token_cursor tokens{payload};
+    return handle_friend_command(p, frame_verb(type), &tokens);
+}
+
+bool client::handle_friend_command(const peer_ptr &p, verb title,
+                                   token_cursor *tokens)
+{
+    switch (title)
+    {
+    case verb::message:
+        return dispatch_friend(p, title, tokens, &client::handle_message);
+    case verb::ping:
+        return dispatch_friend(p, title, tokens, &client::handle_ping);
+    case verb::pong:
+        return dispatch_friend(p, title, tokens, &client::handle_pong);
+    case verb::bulk:
+        return dispatch_friend(p, title, tokens, &client::handle_bulk);
+    case verb::bulk_end:
+        return dispatch_friend(p, title, tokens, &client::handle_bulk_end);
+    case verb::bulk_done:
+        return dispatch_friend(p, title, tokens, &client::handle_bulk_done);
+    case verb::file_begin:
+        return dispatch_friend(p, title, tokens, &client::handle_file_begin);
+    case verb::file_data:
+        return dispatch_friend(p, title, tokens, &client::handle_file_data);
+    case verb::file_end:
+        return dispatch_friend(p, title, tokens, &client::handle_file_end);
+    case verb::file_done:
+        return dispatch_friend(p, title, tokens, &client::handle_file_done);
+    case verb::heartbeat:
+        return true;
+    default:
+        break;
+    }
+
+    log_line{log_level::warning} << "invalid input message from " << label(p);
+    close_peer(p);
+    return false;
+}
+
+template <typename Args>
+bool client::dispatch_friend(const peer_ptr &p, verb title,
+                             token_cursor *tokens,
+                             bool (client::*handler)(const peer_ptr &,
+                                                     const Args &))
+{
+    Args args;
+    if (!parse_args(tokens, &args))
+    {
+        log_line{log_level::warning} << "invalid " << verb_name(title) <<
+                " from " << label(p);
+        close_peer(p);
+        return false;
+    }
+    return (this->*handler)(p, args);
+}
+
+bool client::handle_message(const peer_ptr &, const message_args &args)
+{
+    log_line{} << ">> " << args.from << ": " << args.text;
+    if (message_handler)
+    {
+        message_handler(args.from, args.text);
+    }
+    return true;
+}
+
+bool client::handle_ping(const peer_ptr &p, const ping_args &args)
+{
+    queue_friend_command(p, verb::pong, args.payload);
+    return true;
+}
+
+bool client::handle_bulk(const peer_ptr &p, const data_args &args)
+{
+    p->bench.receive_bulk(args.data.size());
+    return true;
+}
+
+void client::friend_command(string *out, bool binary, verb title,
+                            initializer_list<string_view> args)
+{
+    if (binary)
+    {
+        append_frame(out, frame_type(title), args);
+        return;
+    }
+
+    string_view name = verb_name(title);
+    size_t size = name.size() + 3;
+    for (string_view arg : args)
+    {
+        size += arg.size();
+    }
+    out->reserve(out->size() + size);
+    out->append(name).append(" ");
+    for (string_view arg : args)
+    {
+        out->append(arg);
+    }
+    out->append("\r\n");
+}
+
+void client::queue_friend_command(const peer_ptr &p, verb title,
+                                  string_view args)
+{
+    string command = p->output.acquire();
+    friend_command(&command, p->binary_framing, title, {args});
+    //strand must not wait for its own writer, nor lose a frame the friend
+    //waits for; only a finished link drops it
+    send_buffer::push_result res = p->output.push_control(move(command));
+    if (!res.lost.empty())
+    {
+        log_line{log_level::debug} << verb_name(title) << " to " <<
+                label(p) << " is dropped, link is closed";
+        return;
+    }
+    if (res.wake_writer)
+    {
+        do_friend_write(p);
+    }
+}
+
+void client::fan_out(string_view text, const vector<peer_ptr> &targets,
+                     bool post_wake)
+{
+    //text and binary forms, each built only when some friend uses it
+    thread_local string framed[2];
+    bool built[2] = {false, false};
+    for (const peer_ptr &p : targets)
+    {
+        int binary = p->binary_framing ? 1 : 0;
+        if (!built[binary])
+        {
+            framed[binary].clear();
+            friend_command(&framed[binary], binary, verb::message,
+                           {name, " ", text});
+            built[binary] = true;
+        }
+
+        //built in a recycled string, so steady flow doesn't allocate
+        string message = p->output.acquire();
+        message.assign(framed[binary]);
+        send_buffer::push_result res = p->output.push(move(message));
+        for (const string &mes : res.lost)
+        {
+            log_line{log_level::warning} << "<LOSTED MESSAGE>: " << mes;
+        }
+        if (!res.wake_writer)
+        {
+            continue;
+        }
+        if (post_wake)
+        {
+            //only one wake is in flight, the send_buffer lock orders it
+            //after the previous one released the memory
+            post(strand, make_custom_alloc_handler(p->wake_writer_memory,
+                         [self = shared_from_this(), p]
+                         { self->do_friend_write(p); }));
+        }
+        else
+        {
+            do_friend_write(p);
+        }
+    }
+}
+
+void client::schedule_heartbeat(const peer_ptr &p)
+{
+    p->link_timer.expires_from_now(heartbeat.interval);
+    p->link_timer.async_wait(bind_executor(strand,
+        make_custom_alloc_handler(p->link_memory,
+        [this, p, s = p->socket](boost_error ec)
+        {
+            if (ec || s != p->socket)
+            {
+                return;
+            }
+
+            uint64_t now = metrics::now();
+            uint64_t silence = now - p->last_receive_ns;
+            if (silence >
+                static_cast<uint64_t>(heartbeat.timeout.total_nanoseconds()))
+            {
+                link_lost(p, "no data for " +
+                          std::to_string(silence / 1000000) + " ms");
+                return;
+            }
+            //any data proves the link, heartbeat only fills idle time
+            if (now - p->last_send_ns >=
+                static_cast<uint64_t>(heartbeat.interval.total_nanoseconds()))
+            {
+                queue_friend_command(p, verb::heartbeat, "");
+            }
+            schedule_heartbeat(p);
+        }
+    )));
+}
+
+void client::link_lost(const peer_ptr &p, const string &reason)
+{
+    if (p->state != state_type::communicate_friend)
+    {
+        return;
+    }
+    //friend without heartbeats won't punch again, finish it as before
+    if (!p->heartbeat)
+    {
+        log_line{log_level::error} << "link to " << label(p) <<
+                " is lost (" << reason << ")";
+        close_peer(p);
+        return;
+    }
+
+    log_line{log_level::warning} << "link to " << label(p) << " is lost (" <<
+            reason << ")";
+    reset_link(p);
+    p->recovering = true;
+    p->recovery_stamp.start();
+    change_state(p, state_type::wait_friend);
+    {
+        lock_guard<mutex> lock{peers_mutex};
+        communicating = any_of(peers.begin(), peers.end(),
+            [](const auto &entry)
+            {
+                return entry.second->communicating.load();
+            });
+    }
+
+    if (!is_active_client())
+    {
+        //friend punches again to our acceptor, which is still open
+        p->link_timer.expires_from_now(race_options.deadline);
+        p->link_timer.async_wait(bind_executor(strand,
+            [this, p](boost_error ec)
+            {
+                if (!ec && p->state == state_type::wait_friend)
+                {
+                    log_line{log_level::warning} << label(p) <<
+                            " did not come back";
+                    close_peer(p);
+                }
+            }
+        ));
+        return;
+    }
+    //endpoints are likely the same, rendezvous only when they fail
+    if (!p->candidates.empty())
+    {
+        log_line{} << "punching " << label(p) << " again";
+        race_friend(p, p->candidates);
+    }
+    else
+    {
+        send_get_list();
+    }
+}
+
+void client::reset_link(const peer_ptr &p)
+{
+    p->communicating = false;
+    p->link_timer.cancel();
+    //reset instead of FIN: friend must not take it for the end of session
+    boost_error ec;
+    p->socket->set_option(socket_base::linger{true, 0}, ec);
+    p->socket->close(ec);
+    //completions of the old socket see that it is replaced
+    p->socket.reset();
+    p->framer = line_framer{};
+
+    //batch in flight is lost, queued messages wait for the next link
+    if (p->writing)
+    {
+        p->sending_buffers.clear();
+        p->output.recycle(&p->sending_messages);
+        p->output.release(p->sending_bytes);
+        p->sending_bytes = 0;
+        p->writing = false;
+    }
+    if (p->outgoing_file.is_open() || p->incoming_file.is_open())
+    {
+        log_line{log_level::warning} << "file transfer with " << label(p) <<
+                " is aborted";
+    }
+    p->outgoing_file.close();
+    p->incoming_file.close();
+}
+
+void client::start_link_bench(const peer_ptr &p)
+{
+    if (p->bench.ping_enabled())
+    {
+        send_ping(p, 0);
+    }
+    else
+    {
+        p->bench.start_bulk(metrics::now());
+        pump_bulk(p);
+    }
+}
+
+void client::send_ping(const peer_ptr &p, uint64_t seq)
+{
+    //pong returns sender's timestamp, so no state is kept per ping
+    queue_friend_command(p, verb::ping, std::to_string(seq) + " " +
+                         std::to_string(metrics::now()) + " " +
+                         p->bench.payload());
 }
 
-void client::handle_connect(string answer)
+bool client::handle_pong(const peer_ptr &p, const pong_args &args)
 {
-    if (answer == "confirm_connection")
+    p->bench.add_rtt(metrics::now() - args.sent_ns);
+    if (args.seq + 1 < p->bench.config().count)
     {
-        if (!friend_name.empty())
-        {
-            send_get_list();
-        }
+        send_ping(p, args.seq + 1);
+        return true;
     }
-    else
+
+    p->bench.report_ping(log_line{}.stream(), p->path);
+    if (p->bench.bulk_enabled())
     {
-        cout << "inalid answer for \"connect\": " << answer;
-        close_all();
+        p->bench.start_bulk(metrics::now());
+        pump_bulk(p);
     }
+    else if (bench_handler)
+    {
+        bench_handler(true);
+    }
+    return true;
 }
 
-void client::send_get_list()
+void client::pump_bulk(const peer_ptr &p)
 {
-    if (state != state_type::wait_friend)
+    link_bench &bench = p->bench;
+    if (!bench.bulk_running() || bench.bulk_end_sent)
     {
         return;
     }
 
-    server_buf = "get_list\r\n";
-    async_write(server_socket, buffer(server_buf),
-        [this](boost_error ec, size_t)
-        {
-            if (!ec)
-            {
-                start_read(handle_get_list);
-            }
-            else
-            {
-                cout << "get_list error: " << ec.message() << endl;
-                close_all();
-            }
-        }
-    );
+    //keep half of the send buffer filled, so messages still have room
+    string payload = bench.payload();
+    size_t limit = p->output.max_bytes() / 2;
+    while (bench.bulk_sent < bench.config().count &&
+           p->output.bytes() + payload.size() <= max(limit, payload.size()))
+    {
+        queue_friend_command(p, verb::bulk, payload);
+        ++bench.bulk_sent;
+    }
+    if (bench.bulk_sent == bench.config().count)
+    {
+        queue_friend_command(p, verb::bulk_end,
+                             std::to_string(bench.bulk_sent) + " " +
+                             std::to_string(bench.bulk_sent * payload.size()));
+        bench.bulk_end_sent = true;
+    }
+}
+
+bool client::handle_bulk_end(const peer_ptr &p, const bulk_totals &)
+{
+    queue_friend_command(p, verb::bulk_done,
+                         std::to_string(p->bench.received_messages()) + " " +
+                         std::to_string(p->bench.received_bytes()));
+    p->bench.reset_received();
+    return true;
 }
 
-void client::handle_get_list(string answer)
+bool client::handle_bulk_done(const peer_ptr &p, const bulk_totals &args)
 {
-    string title = get_token(&answer);
-    if (title != "list")
+    p->bench.finish_bulk(metrics::now(), args.bytes);
+    p->bench.report_bulk(log_line{}.stream(), p->path);
+    if (args.messages != p->bench.config().count)
     {
-        cout << "get_list invalid answer" << endl;
-        close_all();
-        return;
+        log_line{} << "bulk: " << label(p) << " received " <<
+                args.messages << " of " << p->bench.config().count <<
+                " messages";
     }
+    if (bench_handler)
+    {
+        bench_handler(args.messages == p->bench.config().count);
+    }
+    return true;
+}
 
-    if (state != state_type::wait_friend)
+void client::do_friend_write(const peer_ptr &p)
+{
+    //everything queued goes out in one gathered write, messages queued
+    //meanwhile wait for the next one; while a lost link is punched again
+    //they wait for start_commutation
+    if (closed || p->writing ||
+        p->state != state_type::communicate_friend || !p->socket)
     {
         return;
     }
-
-    string cl;
-    while (!(cl = get_token(&answer)).empty())
+    if (!p->output.take(&p->sending_messages))
     {
-        if (cl == friend_name)
+        //file chunks use the link only when no message is waiting
+        if (p->outgoing_file.is_open() && !p->outgoing_file.finished())
         {
-            send_get_info();
-            return;
+            send_file_chunk(p);
         }
+        return;
+    }
+    p->writing = true;
+    for (const string &mes : p->sending_messages)
+    {
+        p->sending_buffers.push_back(buffer(mes));
+        p->sending_bytes += mes.size();
     }
 
-    friend_repeat_timer.expires_from_now(FRIEND_REPEAT_PERIOD);
-    friend_repeat_timer.async_wait(
-        [this](boost_error ec)
+    ++friend_writes.batches;
+    friend_writes.messages += p->sending_messages.size();
+    continue_friend_write(p);
+}
+
+void client::continue_friend_write(const peer_ptr &p)
+{
+    buffer_span pending{p->sending_buffers.data(),
+                        p->sending_buffers.data() + p->sending_buffers.size()};
+    p->socket->async_write_some(pending,
+        bind_executor(strand, make_custom_alloc_handler(p->write_memory,
+        [this, p, s = p->socket](boost_error ec, size_t bytes)
         {
-            if (!ec)
+            if (s != p->socket)
             {
-                send_get_list();
+                return;
             }
-            else
+            if (ec)
             {
-                cout << "repeat timer error: " << ec.message() << endl;
-                close_all();
+                link_lost(p, "write error: " + ec.message());
+                return;
             }
-        }
-    );
-}
 
-void client::send_get_info()
-{
-    if (state != state_type::wait_friend)
-    {
-        return;
-    }
+            p->last_send_ns = metrics::now();
+            ++friend_writes.syscalls;
+            friend_writes.bytes += bytes;
 
-    server_buf = "get_info " + friend_name + "\r\n";
-    async_write(server_socket, buffer(server_buf),
-        [this](boost_error ec, size_t)
-        {
-            if (!ec)
+            auto it = p->sending_buffers.begin();
+            for (; it != p->sending_buffers.end() && bytes >= it->size(); ++it)
             {
-                start_read(handle_get_info);
+                bytes -= it->size();
             }
-            else
+            p->sending_buffers.erase(p->sending_buffers.begin(), it);
+            if (!p->sending_buffers.empty())
             {
-                cout << "get_info error: " << ec.message() << endl;
-                close_all();
+                p->sending_buffers.front() += bytes;
+                continue_friend_write(p);
+                return;
+            }
+
+            p->writing = false;
+            p->output.recycle(&p->sending_messages);
+            p->output.release(p->sending_bytes);
+            p->sending_bytes = 0;
+            if (input_stalled)
+            {
+                input_stalled = false;
+                drain_input();
             }
+            pump_bulk(p);
+            do_friend_write(p);
         }
-    );
+    )));
 }
 
-void client::handle_get_info(string answer)
+void client::start_file_send(const peer_ptr &p, const string &path)
 {
-    string title = get_token(&answer);
-    if (title != "info")
+    //raw file bytes can't be sent as a line
+    if (!p->binary_framing)
     {
-        cout << "get_info invalid answer title" << endl;
-        send_get_list();
+        log_line{log_level::warning} << "file transfer to " << label(p) <<
+                " needs binary framing (--framing binary)";
         return;
     }
-
-    if (state != state_type::wait_friend)
+    if (p->outgoing_file.is_open())
     {
+        log_line{log_level::warning} << "file " << p->outgoing_file.name() <<
+                " is still being sent to " << label(p);
         return;
     }
 
-    string private_address = get_token(&answer);
-    string private_port = get_token(&answer);
-    string public_address = get_token(&answer);
-    string public_port = get_token(&answer);
-
-    tcp::endpoint private_endpoint = tcp::endpoint{
-            ip::address::from_string(private_address),
-            static_cast<uint16_t>(stoi(private_port))};
-    tcp::endpoint public_endpoint = tcp::endpoint{
-            ip::address::from_string(public_address),
-            static_cast<uint16_t>(stoi(public_port))};
+    string error;
+    if (!p->outgoing_file.open(path, &error))
+    {
+        log_line{log_level::error} << "send " << path << " error: " << error;
+        return;
+    }
+    //sendfile is called directly and must not block the io thread
+    boost_error ec;
+    p->socket->native_non_blocking(true, ec);
+    if (ec)
+    {
+        log_line{log_level::error} << "send " << path << " error: " <<
+                ec.message();
+        p->outgoing_file.close();
+        return;
+    }
 
-    socket_ptr private_socket = make_shared<tcp::socket>(service);
-    socket_ptr public_socket = make_shared<tcp::socket>(service);
+    p->outgoing_progress.start(p->outgoing_file.size(), metrics::now());
+    queue_friend_command(p, verb::file_begin,
+                         std::to_string(p->outgoing_file.size()) + " " +
+                         p->outgoing_file.name());
+    if (p->outgoing_file.finished())
+    {
+        finish_file_send(p);
+    }
+}
 
-    private_socket->async_connect(private_endpoint,
-        [this, private_socket](boost_error ec)
-        {
-            if (!ec)
-            {
-                cout << "communication started on private endpoint" << endl;
-                activate_commutation(private_socket);
-            }
-            else
-            {
-                cout << "friend private connection error: " <<
-                        ec.message() << endl;
-            }
-        }
-    );
-    public_socket->async_connect(public_endpoint,
-        [this, public_socket](boost_error ec)
+void client::send_file_chunk(const peer_ptr &p)
+{
+    p->writing = true;
+    p->file_chunk_left = min<uint64_t>(FILE_CHUNK_SIZE,
+            p->outgoing_file.size() - p->outgoing_file.sent());
+    p->file_chunk_header.clear();
+    append_frame_header(&p->file_chunk_header, frame_type(verb::file_data),
+                        p->file_chunk_left);
+    async_write(*p->socket, buffer(p->file_chunk_header),
+        bind_executor(strand, make_custom_alloc_handler(p->write_memory,
+        [this, p, s = p->socket](boost_error ec, size_t bytes)
         {
-            if (!ec)
+            if (s != p->socket)
             {
-                cout << "communication started on public endpoint" << endl;
-                activate_commutation(public_socket);
+                return;
             }
-            else
+            if (ec)
             {
-                cout << "friend public connection error: " <<
-                        ec.message() << endl;
+                link_lost(p, "write error: " + ec.message());
+                return;
             }
+            p->last_send_ns = metrics::now();
+            ++friend_writes.syscalls;
+            friend_writes.bytes += bytes;
+            continue_file_chunk(p);
         }
-    );
+    )));
 }
 
-void client::activate_commutation(socket_ptr s)
+void client::continue_file_chunk(const peer_ptr &p)
 {
-    if (state == state_type::communicate_friend)
-    {
-        return;
-    }
-
-    if (!is_active_client())
+    while (p->file_chunk_left > 0)
     {
-        available_sockets.push_back(s);
-
-        auto send_confirm =
-            [self = shared_from_this(), s, buf = make_shared<string>()]
-            {
-                *buf = "confirm_activation\r\n";
-                async_write(*s, buffer(*buf),
-                    [self, buf](boost_error ec, size_t)
+        long bytes = p->outgoing_file.send_to(p->socket->native_handle(),
+                                              p->file_chunk_left);
+        if (bytes < 0)
+        {
+            link_lost(p, string{"send file error: "} + strerror(errno));
+            return;
+        }
+        if (bytes == 0)
+        {
+            p->socket->async_wait(tcp::socket::wait_write,
+                bind_executor(strand, make_custom_alloc_handler(p->write_memory,
+                [this, p, s = p->socket](boost_error ec)
+                {
+                    if (s != p->socket)
                     {
-                        if (ec)
-                        {
-                            cout << "write activation confirm error" << endl;
-                            self->close_all();
-                        }
+                        return;
                     }
-                );
-            };
-
-        auto handler =
-            [self = shared_from_this(), s, send_confirm](string answer)
-            {
-                if (answer == "activate")
-                {
-                    for (auto so : self->available_sockets)
+                    if (ec)
                     {
-                        if (so != s)
-                        {
-                            so->close();
-                        }
+                        link_lost(p, "write error: " + ec.message());
+                        return;
                     }
-                    self->available_sockets.clear();
-                    send_confirm();
-                    self->start_commutation(s);
+                    continue_file_chunk(p);
                 }
-                else
-                {
-                    cout << "invalid activate command" << endl;
-                    self->close_all();
-                }
-            };
+            )));
+            return;
+        }
 
-        auto buf = make_shared<vector<char>>();
-        buf->resize(MAX_READ_SERVER_BUF_SIZE);
-        async_read(*s, buffer(*buf),
-                   [self = shared_from_this(), buf]
-                   (boost_error ec, size_t bytes)
-                   { return self->read_complete(*buf, ec, bytes); },
-                   [self = shared_from_this(), buf, handler]
-                   (boost_error ec, size_t bytes)
-                   { self->read(*buf, handler, ec, bytes); }
-        );
+        p->last_send_ns = metrics::now();
+        ++friend_writes.syscalls;
+        friend_writes.bytes += bytes;
+        p->file_chunk_left -= bytes;
+        if (p->outgoing_progress.advance(bytes))
+        {
+            p->outgoing_progress.report(log_line{}.stream(), "send",
+                                        p->outgoing_file.name(),
+                                        metrics::now());
+        }
     }
 
-    if (state != state_type::wait_friend)
+    //messages queued meanwhile go before the next chunk
+    p->writing = false;
+    if (p->outgoing_file.finished())
     {
-        return;
+        finish_file_send(p);
     }
+    do_friend_write(p);
+}
 
-    state = state_type::connect_friend;
-    if (is_active_client())
-    {
-        auto handler =
-            [self = shared_from_this(), s](string answer)
-            {
-                if (answer == "confirm_activation")
-                {
-                    self->start_commutation(s);
-                }
-                else
-                {
-                    cout << "invalid confirm activation command" << endl;
-                    self->close_all();
-                }
-            };
-
-        auto read_confirm =
-            [self = shared_from_this(), s, handler]
-            {
-                auto buf = make_shared<vector<char>>();
-                buf->resize(MAX_READ_SERVER_BUF_SIZE);
-                async_read(*s, buffer(*buf),
-                           [self, buf]
-                           (boost_error ec, size_t bytes)
-                           { return self->read_complete(*buf, ec, bytes); },
-                           [self, buf, handler]
-                           (boost_error ec, size_t bytes)
-                           { self->read(*buf, handler, ec, bytes); }
-                );
-            };
-
-        auto buf = make_shared<string>();
-        *buf = "activate\r\n";
-        async_write(*s, buffer(*buf),
-            [self = shared_from_this(), s, buf, read_confirm]
-            (boost_error ec, size_t)
-            {
-                if (!ec)
-                {
-                    read_confirm();
-                }
-                else
-                {
-                    cout << "write activate error" << endl;
-                    self->close_all();
-                }
-            }
-        );
-    }
+void client::finish_file_send(const peer_ptr &p)
+{
+    p->outgoing_file.close();
+    queue_friend_command(p, verb::file_end,
+                         std::to_string(p->outgoing_file.size()));
 }
 
-void client::start_commutation(client::socket_ptr s)
+bool client::handle_file_begin(const peer_ptr &p,
+                               const file_begin_args &args)
 {
-    friend_active_socket = s;
-    state = state_type::communicate_friend;
+    //only the name is taken, friend can't write outside current directory
+    string path = file_receiver::local_name(args.name);
+    if (path.empty())
+    {
+        log_line{log_level::warning} << "invalid file_begin";
+        close_peer(p);
+        return false;
+    }
+    if (p->incoming_file.is_open())
+    {
+        log_line{log_level::warning} << "file " << p->incoming_file.name() <<
+                " is not finished";
+        close_peer(p);
+        return false;
+    }
 
-    cout << "communication started" << endl;
-    do_friend_read();
+    string error;
+    if (!p->incoming_file.open(path, args.size, &error))
+    {
+        log_line{log_level::error} << "receive " << path << " error: " << error;
+        close_peer(p);
+        return false;
+    }
+    log_line{} << "receiving " << args.size << " bytes from " << label(p) <<
+            " into " << path;
+    p->incoming_progress.start(args.size, metrics::now());
+    return true;
 }
 
-void client::do_friend_read()
+bool client::handle_file_data(const peer_ptr &p, const data_args &args)
 {
-    using namespace std::placeholders;
-    async_read(*friend_active_socket, buffer(friend_read_buf),
-               bind(&client::read_complete_from_friend,
-                    shared_from_this(), _1, _2),
-               bind(&client::read_from_friend, shared_from_this(),
-                    [self = shared_from_this()](string message)
-                    { return self->handle_friend_message(move(message)); },
-                    _1, _2));
+    if (!p->incoming_file.is_open() || !p->incoming_file.write(args.data))
+    {
+        log_line{log_level::warning} << "unexpected file data";
+        close_peer(p);
+        return false;
+    }
+    if (p->incoming_progress.advance(args.data.size()))
+    {
+        p->incoming_progress.report(log_line{}.stream(), "receive",
+                                    p->incoming_file.name(), metrics::now());
+    }
+    return true;
 }
 
-void client::handle_friend_message(string message)
+bool client::handle_file_end(const peer_ptr &p, const file_size_args &args)
 {
-    string title = get_token(&message);
-    string name = get_token(&message);
-    string text = move(message);
-    if (title == "message" && !name.empty() && !text.empty())
+    if (!p->incoming_file.is_open())
     {
-        cout << ">> " << name << ": " << text << endl;
-        do_friend_read();
+        log_line{log_level::warning} << "unexpected file_end";
+        close_peer(p);
+        return false;
     }
-    else
+
+    uint64_t received = p->incoming_file.received();
+    p->incoming_file.close();
+    if (received != args.bytes)
     {
-        cout << "invalid input message" << endl;
-        close_all();
+        log_line{log_level::warning} << "receive " <<
+                p->incoming_file.name() << ": got " << received <<
+                " of " << args.bytes << " bytes";
     }
+    queue_friend_command(p, verb::file_done, std::to_string(received));
+    return true;
 }
 
-void client::do_friend_write()
+bool client::handle_file_done(const peer_ptr &p, const file_size_args &args)
 {
-    async_write(*friend_active_socket, buffer(output_messages.front()),
-        [this](boost_error ec, size_t)
-        {
-            if (!ec)
-            {
-                output_messages.pop();
-                if (!output_messages.empty())
-                {
-                    do_friend_write();
-                }
-            }
-            else
-            {
-                cout << "write to friend error: " << ec.message() << endl;
-                close_all();
-            }
-        }
-    );
+    //throughput up to friend's confirmation, not only to the socket buffer
+    log_line{} << "file " << p->outgoing_file.name() << " is delivered to " <<
+            label(p) << " (" << args.bytes << " bytes)";
+    p->outgoing_progress.report(log_line{}.stream(), "send",
+                                p->outgoing_file.name(), metrics::now());
+    return true;
+}
+
+void client::print_write_stats()
+{
+    if (friend_writes.syscalls == 0)
+    {
+        return;
+    }
+
+    log_line{} << "friend writes: " << friend_writes.messages <<
+            " messages, " <<
+            friend_writes.bytes << " bytes in " << friend_writes.syscalls <<
+            " syscalls (" << friend_writes.batches << " batches), " <<
+            double(friend_writes.messages) / friend_writes.syscalls <<
+            " messages and " <<
+            friend_writes.bytes / friend_writes.syscalls <<
+            " bytes per syscall";
 }
 
 bool client::start_acceptor()
@@ -469,186 +2301,193 @@ bool client::start_acceptor()
     acceptor.open(private_endpoint.protocol(), ec);
     if (ec)
     {
-        cout << "acceptor open error: " << ec.message() << endl;
+        log_line{log_level::error} << "acceptor open error: " << ec.message();
         close_all();
         return false;
     }
-    acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true),
-                        ec);
+    share_local_port(acceptor, ec);
     if (ec)
     {
-        cout << "acceptor so_reuseaddress error: " << ec.message() << endl;
+        log_line{log_level::error} << "acceptor so_reuseaddress error: " <<
+                ec.message();
         close_all();
         return false;
     }
     acceptor.bind(private_endpoint, ec);
     if (ec)
     {
-        cout << "acceptor bind error: " << ec.message() << endl;
+        log_line{log_level::error} << "acceptor bind error: " << ec.message();
         close_all();
         return false;
     }
     acceptor.listen();
 
+    accept_stamp.start();
+    do_accept();
+    return true;
+}
+
+//friends keep coming while the session lives, also one from several of its
+//addresses
+void client::do_accept()
+{
     socket_ptr friend_server_socket = make_shared<tcp::socket>(service);
-    acceptor.async_accept(*friend_server_socket,
+    acceptor.async_accept(*friend_server_socket, bind_executor(strand,
         [this, friend_server_socket](boost_error ec)
         {
             if (!ec)
             {
-                cout << "communication accepted" << endl;
-                activate_commutation(friend_server_socket);
+                if (!communicating)
+                {
+                    accept_stamp.record(metric::friend_accept);
+                }
+                log_line{} << "communication accepted";
+                if (is_active_client())
+                {
+                    //the only friend is known before its confirmation
+                    activate_commutation(friend_server_socket,
+                            peers.size() == 1 ? peers.begin()->second :
+                                                nullptr,
+                            "accepted");
+                }
+                else
+                {
+                    accept_activation(friend_server_socket);
+                }
+                do_accept();
             }
-            else
+            else if (ec != error::operation_aborted)
             {
-                cout << "accept friend error: " << ec.message() << endl;
+                log_line{log_level::error} << "accept friend error: " <<
+                        ec.message();
             }
         }
-    );
-
-    return true;
+    ));
 }
 
 void client::fill_private_endpoint()
 {
-    tcp::resolver res{service};
-    string host = ip::host_name();
+    //cached interface list, no blocking name resolution on io thread
+    private_addresses = local_addresses::get();
+    uint16_t port = server_socket.local_endpoint().port();
 
-    auto it = find_if(res.resolve({host, ""}), {},
-        [](const auto &re)
-        { return re.endpoint().address().is_v4() &&
-                !re.endpoint().address().is_loopback(); }
-    );
-    if (it != tcp::resolver::iterator{})
+    auto it = find_if(private_addresses.begin(), private_addresses.end(),
+                      [](const ip::address &a){ return a.is_v4(); });
+    if (it != private_addresses.end())
     {
-        private_endpoint = tcp::endpoint{it->endpoint().address(),
-                                         server_socket.local_endpoint().port()};
+        private_endpoint = tcp::endpoint{*it, port};
     }
     else
     {
-        private_endpoint = tcp::endpoint{tcp::v4(),
-                                         server_socket.local_endpoint().port()};
+        private_endpoint = tcp::endpoint{tcp::v4(), port};
     }
 }
 
-void client::start_read(void(client::*handler)(string))
-{
-    using namespace std::placeholders;
-    async_read(server_socket, buffer(server_read_buf),
-               bind(&client::read_complete_from_server,
-                    shared_from_this(), _1, _2),
-               bind(&client::read_from_server,
-                    shared_from_this(),
-                    [self = shared_from_this(), handler](std::string answer)
-                    { ((*self).*handler)(move(answer)); },
-                    _1, _2)
-    );
-}
-
-template <typename Buffer>
-size_t client::read_complete(const Buffer &buf, boost::system::error_code ec,
-                             size_t bytes)
+template <typename Handler>
+void client::read_line(tcp::socket &s, line_framer &framer,
+                       handler_memory &memory, Handler handler)
 {
-    if (ec)
-    {
-        return 0;
-    }
-
-    auto end = buf.cbegin() + bytes;
-    auto start_it = find_if(buf.cbegin(), end,
-                            [](char c){ return !isspace(c); });
-    if (start_it == end)
+    string_view line;
+    if (framer.next_line(&line))
     {
-        return 1;
+        handler(boost_error{}, line);
+        return;
     }
-
-    auto finish_it = find_if(next(start_it), end,
-                             [](char c){ return isspace(c) && c != ' '; });
-    if (finish_it == end)
+    if (framer.overflow())
     {
-        return 1;
+        handler(error::message_size, string_view{});
+        return;
     }
 
-    return 0;
+    s.async_read_some(framer.prepare(), bind_executor(strand,
+        make_custom_alloc_handler(memory,
+        [self = shared_from_this(), &s, &framer, &memory, handler]
+        (boost_error ec, size_t bytes) mutable
+        {
+            if (!ec)
+            {
+                framer.commit(bytes);
+                self->read_line(s, framer, memory, move(handler));
+            }
+            else
+            {
+                handler(ec, string_view{});
+            }
+        }
+    )));
 }
 
-size_t client::read_complete_from_server(boost_error ec, size_t bytes)
+void client::close_peer(const peer_ptr &p)
 {
-    if (!ec)
+    if (p->state == state_type::closed)
     {
-        return read_complete(server_read_buf, ec, bytes);
+        return;
     }
-    else
+    shutdown_peer(p);
+    log_line{} << "communication with " << label(p) << " is finished";
+    //lines waiting for this friend's buffer go to the others now
+    if (input_stalled)
     {
-        cout << "read from server error: " << ec.message() << endl;
-        close_all();
+        input_stalled = false;
+        post(strand, [self = shared_from_this()]{ self->drain_input(); });
     }
-}
 
-size_t client::read_complete_from_friend(boost_error ec, size_t bytes)
-{
-    if (!ec)
+    bool alive = false;
+    bool any_communicating = false;
     {
-        return read_complete(friend_read_buf, ec, bytes);
+        lock_guard<mutex> lock{peers_mutex};
+        //accepted friends are forgotten, configured ones keep their entry
+        if (!is_active_client())
+        {
+            peers.erase(p->key);
+        }
+        for (auto &entry : peers)
+        {
+            alive = alive || entry.second->state != state_type::closed;
+            any_communicating = any_communicating ||
+                                entry.second->communicating;
+        }
     }
-    else
+    communicating = any_communicating;
+    if (!alive)
     {
-        cout << "read from friend error: " << ec.message() << endl;
         close_all();
     }
 }
 
-template <typename Buffer>
-void client::read(const Buffer &buf,
-                  std::function<void (string)> handler,
-                  boost_error ec, size_t bytes)
+void client::shutdown_peer(const peer_ptr &p)
 {
-    if (ec)
-    {
-        return;
-    }
-
-    auto end = buf.begin() + bytes;
-    auto start_it = find_if(buf.begin(), end,
-                            [](char c){ return !isspace(c); });
-    auto finish_it = find_if(next(start_it), end,
-                             [](char c){ return isspace(c) && c != ' '; });
-
-    string request{start_it, finish_it};
-    handler(move(request));
-}
-
-void client::read_from_server(function<void (string)> handler,
-                              boost_error ec, size_t bytes)
-{
-    if (!ec)
+    p->state = state_type::closed;
+    p->communicating = false;
+    p->link_timer.cancel();
+    if (p->race)
     {
-        read(server_read_buf, handler, ec, bytes);
+        p->race->cancel();
     }
-    else
+    p->output.close();
+    if (p->socket)
     {
-        cout << "read from server error: " << ec.message() << endl;
-        close_all();
+        boost_error ec;
+        p->socket->close(ec);
     }
+    //unfinished received file keeps its announced size with zero tail
+    p->outgoing_file.close();
+    p->incoming_file.close();
 }
 
-void client::read_from_friend(std::function<void (string)> handler,
-                              boost_error ec, size_t bytes)
+void client::close_all()
 {
-    if (!ec)
-    {
-        read(friend_read_buf, handler, ec, bytes);
-    }
-    else
+    if (closed)
     {
-        cout << "read from friend error: " << ec.message() << endl;
-        close_all();
+        return;
     }
-}
+    closed = true;
 
-void client::close_all()
-{
     server_socket.close();
+    friend_repeat_timer.cancel();
+    watch_timer.cancel();
+    features_timer.cancel();
+    communicating = false;
     acceptor.close();
     for (auto s : available_sockets)
     {
@@ -657,9 +2496,15 @@ void client::close_all()
             s->close();
         }
     }
-    if (friend_active_socket)
+    for (auto &entry : peers)
+    {
+        shutdown_peer(entry.second);
+    }
+    print_write_stats();
+
+    if (close_handler)
     {
-        friend_active_socket->close();
+        close_handler();
     }
 }
 
@@ -668,20 +2513,15 @@ string client::to_string(tcp::endpoint endpoint)
     return endpoint.address().to_string() + " " + ::to_string(endpoint.port());
 }
 
-string client::get_token(string *s)
+bool client::parse_endpoint(token_cursor *tokens, tcp::endpoint *endpoint)
 {
-    size_t space_index = s->find_first_of(' ');
-    size_t token_index = space_index == string::npos ? s->length() :
-                                                       space_index;
-
-    string res = s->substr(0, token_index);
-    if (token_index != s->length())
-    {
-        *s = s->substr(token_index + 1);
-    }
-    else
+    boost_error ec;
+    ip::address address = ip::make_address(tokens->next(), ec);
+    uint16_t port;
+    if (ec || !token_cursor::to_port(tokens->next(), &port))
     {
-        s->clear();
+        return false;
     }
-    return res;
+    *endpoint = tcp::endpoint{address, port};
+    return true;
 }
@@ -2,91 +2,427 @@
 #define CLIENT_H
 
 #include <string>
-#include <array>
+#include <string_view>
 #include <vector>
-#include <queue>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <atomic>
 #include <memory>
 #include <functional>
+#include <initializer_list>
 #include <boost/asio.hpp>
 
+#include "line_framer.h"
+#include "send_buffer.h"
+#include "metrics.h"
+#include "link_bench.h"
+#include "connection_race.h"
+#include "peer_cache.h"
+#include "handler_memory.h"
+#include "command_table.h"
+#include "spsc_ring.h"
+#include "file_transfer.h"
+#include "friend_commands.h"
+
+class token_cursor;
+
 class client : public std::enable_shared_from_this<client>
 {
-    client(std::string name, std::string server_ip, uint16_t server_port,
-           std::string friend_name);
+    client(std::unique_ptr<boost::asio::io_service> own_service,
+           boost::asio::io_service &service,
+           std::string name, std::string server_ip, uint16_t server_port,
+           std::vector<std::string> friend_names);
 
 public:
     using ptr = std::shared_ptr<client>;
+    //client punches to every friend, without friends it only accepts them
     static ptr create(std::string name,
                       std::string server_ip, uint16_t server_port,
-                      std::string friend_name);
+                      std::vector<std::string> friend_names);
+    //client works on external service, which is run by the caller
+    static ptr create(boost::asio::io_service &service, std::string name,
+                      std::string server_ip, uint16_t server_port,
+                      std::vector<std::string> friend_names);
 
-    void run();
-    void write(const std::string &text);
+    //start session and run own service on the given number of threads
+    //(only start on external service, which may be run by any number of
+    //threads too)
+    void run(size_t threads = 1);
+    void start();
+    //to every communicating friend or only to the named one; may be called
+    //from any thread, blocks with block overflow policy
+    void write(const std::string &text, const std::string &to = "");
+    //single producer (stdin) path: line is swapped with a recycled string,
+    //io thread drains the ring in batches with one wakeup per batch;
+    //"@name text" goes to one friend; false when the ring is full and line
+    //is kept
+    bool write_input(std::string *line);
+    //sends file to every communicating friend or the named one over binary
+    //framing, messages keep going between its chunks; may be called from
+    //any thread
+    void send_file(const std::string &path, const std::string &to = "");
+
+    //counted on the session strand, may be read from any thread
+    struct write_stats
+    {
+        std::atomic<uint64_t> batches{0};
+        std::atomic<uint64_t> syscalls{0};
+        std::atomic<uint64_t> messages{0};
+        std::atomic<uint64_t> bytes{0};
+    };
+    //sum over all friends
+    const write_stats &friend_write_stats() const { return friend_writes; }
+
+    //call before start
+    void set_send_options(const send_buffer::options &opts);
+    //producers of write() should pause on high and resume on low watermark
+    //(high while any friend queue is above it)
+    void set_watermark_handlers(std::function<void()> high,
+                                std::function<void()> low);
+    //active client offers length-prefixed binary framing of friend data,
+    //passive one always accepts it
+    void set_binary_framing(bool offer);
+    //run the link test once communication starts (on active client)
+    void set_link_bench(const link_bench::options &opts);
+    //stagger and retries of friend candidates (local port is the acceptor
+    //one) and count of ports after friend public one to try
+    void set_race_options(const connection_race::options &opts,
+                          unsigned predicted_ports);
+    struct heartbeat_options
+    {
+        //idle link is refreshed this often, zero disables heartbeats
+        boost::posix_time::time_duration interval =
+                boost::posix_time::milliseconds(0);
+        //friend link is lost after this long silence
+        boost::posix_time::time_duration timeout =
+                boost::posix_time::milliseconds(600);
+    };
+    //heartbeats run only when both friends enable them; lost link is
+    //punched again with the known friend endpoints
+    void set_heartbeat(const heartbeat_options &opts);
+    //friends punched before are punched again from the cache file as soon
+    //as the acceptor is up, while the server lookup runs in parallel;
+    //records older than ttl are ignored
+    void set_peer_cache(const std::string &path,
+                        boost::posix_time::time_duration ttl);
+    //called when communication with each friend starts
+    void set_communication_handler(std::function<void()> handler);
+    void set_close_handler(std::function<void()> handler);
+    //called on the session strand for every message of a friend, with the
+    //name it sends and the text
+    void set_message_handler(
+            std::function<void(std::string_view, std::string_view)> handler);
+    //called when the link test with a friend finishes, with false when the
+    //friend did not receive every bulk message
+    void set_bench_handler(std::function<void(bool)> handler);
 
 private:
-    boost::asio::io_service service;
+    using socket_ptr = std::shared_ptr<boost::asio::ip::tcp::socket>;
+    using framer_ptr = std::shared_ptr<line_framer>;
+    enum class state_type {wait_friend, connect_friend, communicate_friend,
+                           closed};
+
+    //one friend: its punch state machine, connection and output queue
+    struct peer
+    {
+        explicit peer(boost::asio::io_service &service) :
+            link_timer{service}
+        {
+        }
+
+        //empty for a friend which doesn't tell its name
+        std::string name;
+        //of the peer table, unique also for friends without names
+        std::string key;
+        state_type state = state_type::wait_friend;
+        //get_info is in flight or server watches friend registration
+        bool lookup_pending = false;
+        bool watched = false;
+        connection_race::ptr race;
+        //endpoints of the last get_info, punched again when link is lost
+        std::vector<connection_race::candidate> candidates;
+        //race runs on cached endpoints which the server didn't confirm yet
+        bool cached_race = false;
+
+        socket_ptr socket;
+        //"private", "public", "predicted" or "accepted"
+        std::string path;
+        line_framer framer;
+        //read by producers of write() while a lost link is punched again
+        std::atomic<bool> binary_framing{false};
+        std::atomic<bool> communicating{false};
+        link_bench bench;
+        //heartbeat ticks, or wait for friend to punch again (passive side)
+        boost::asio::deadline_timer link_timer;
+        bool heartbeat = false;
+        uint64_t last_receive_ns = 0;
+        uint64_t last_send_ns = 0;
+
+        send_buffer output;
+        //messages of the gathered write in flight and the rest of its
+        //buffers; writing is set while a batch or a file chunk is written
+        std::vector<std::string> sending_messages;
+        size_t sending_bytes = 0;
+        std::vector<boost::asio::const_buffer> sending_buffers;
+        bool writing = false;
+
+        //file being sent (with header of its chunk in flight) and received
+        file_sender outgoing_file;
+        transfer_progress outgoing_progress;
+        std::string file_chunk_header;
+        uint64_t file_chunk_left = 0;
+        file_receiver incoming_file;
+        transfer_progress incoming_progress;
+
+        //operations of the hot path reuse these instead of the heap
+        handler_memory read_memory;
+        handler_memory write_memory;
+        handler_memory wake_writer_memory;
+        handler_memory link_memory;
+
+        metric_stamp state_stamp;
+        metric_stamp online_stamp;
+        metric_stamp private_connect_stamp;
+        metric_stamp public_connect_stamp;
+        metric_stamp activation_stamp;
+        metric_stamp recovery_stamp;
+        bool recovering = false;
+    };
+    using peer_ptr = std::shared_ptr<peer>;
+
+    //requests are pipelined; server which confirms "ids" echoes "#<id>"
+    //of every request in its answer, older servers answer in order, so
+    //untagged requests are matched first in first out; handler gets
+    //interned first token and the rest of the answer
+    struct server_request;
+    using answer_handler = void(client::*)(verb, token_cursor *,
+                                           const server_request &);
+    struct server_request
+    {
+        answer_handler handler;
+        //friend of the request, null for requests of the whole client
+        peer_ptr p;
+        metric_stamp stamp;
+        //zero for untagged request
+        uint32_t id;
+        //answer of optional request, unknown for the others
+        verb optional;
+    };
+
+    std::unique_ptr<boost::asio::io_service> own_service;
+    boost::asio::io_service &service;
+    //every handler of the session runs here, so the service may be run by
+    //any number of threads
+    boost::asio::io_service::strand strand;
     boost::asio::ip::tcp::socket server_socket;
     std::string name;
     boost::asio::ip::tcp::endpoint server_endpoint ;
-    std::string server_buf;
-    static constexpr size_t MAX_READ_SERVER_BUF_SIZE = 1024;
-    std::array<char, MAX_READ_SERVER_BUF_SIZE> server_read_buf;
+    line_framer server_framer;
+    std::deque<std::string> server_output;
+    //every queued request goes out in one gathered write
+    std::vector<boost::asio::const_buffer> server_write_buffers;
+    std::deque<server_request> server_requests;
+    bool server_ids = false;
+    uint32_t last_request_id = 0;
+    //server filters get_list by friend names
+    bool server_list_filters = false;
+    //request of a list answer longer than the framer holds, its names are
+    //taken as they arrive and the rest comes as a line of names
+    server_request list_request;
+    bool list_streaming = false;
 
-    std::string friend_name;
+    std::vector<std::string> friend_names;
     boost::asio::deadline_timer friend_repeat_timer;
+    bool get_list_scheduled = false;
+    //server notifies about friend registration, otherwise list is polled
+    bool watch_supported = true;
+    //watch requests without answer; the timer runs while there are some
+    size_t watch_requests = 0;
+    boost::asio::deadline_timer watch_timer;
+    //features request is dropped when the server stays silent
+    boost::asio::deadline_timer features_timer;
 
-    using socket_ptr = std::shared_ptr<boost::asio::ip::tcp::socket>;
     boost::asio::ip::tcp::endpoint private_endpoint;
+    //all usable local addresses, private_endpoint uses first IPv4 one
+    std::vector<boost::asio::ip::address> private_addresses;
     boost::asio::ip::tcp::acceptor acceptor;
-    enum class state_type {wait_friend, connect_friend, communicate_friend}
-        state = state_type::wait_friend;
+    connection_race::options race_options;
+    unsigned predicted_ports = 0;
+    //accepted sockets which wait for friend activation
     std::vector<socket_ptr> available_sockets;
-    socket_ptr friend_active_socket;
-    std::array<char, MAX_READ_SERVER_BUF_SIZE> friend_read_buf;
-    static constexpr size_t MAX_SAVED_OUTPUT_MESSAGES = 16;
-    std::queue<std::string> output_messages;
+    handler_memory handshake_memory;
+    std::string peer_cache_path;
+    boost::posix_time::time_duration peer_cache_ttl;
+    peer_cache endpoint_cache;
+
+    //changed only on io thread, which reads it without the lock; other
+    //threads lock it to find friends of write()
+    std::mutex peers_mutex;
+    std::map<std::string, peer_ptr, std::less<>> peers;
+    size_t nameless_peers = 0;
+    //any friend is communicating
+    std::atomic<bool> communicating{false};
+
+    //applied to every friend
+    send_buffer::options send_options;
+    std::function<void()> high_handler;
+    std::function<void()> low_handler;
+    std::atomic<int> high_peers{0};
+    bool offer_binary_framing = false;
+    heartbeat_options heartbeat;
+    link_bench::options bench_options;
+    write_stats friend_writes;
+
+    handler_memory server_read_memory;
+    //lines of write_input and the drain which is posted or stalled
+    spsc_ring<std::string> input_ring{4096};
+    std::atomic<bool> input_wake{false};
+    bool input_stalled = false;
+    handler_memory input_wake_memory;
+    std::vector<peer_ptr> input_targets;
+
+    //timestamps of the phases for metrics
+    metric_stamp session_stamp;
+    metric_stamp accept_stamp;
+
+    std::function<void()> communication_handler;
+    std::function<void()> close_handler;
+    std::function<void(bool)> bench_handler;
+    std::function<void(std::string_view, std::string_view)> message_handler;
+    bool closed = false;
 
     void open_connection();
+    peer_ptr add_peer(std::string peer_name);
+    peer_ptr find_peer(std::string_view peer_name);
+    //friends communicating now, all or the named one
+    void collect_targets(std::string_view to, std::vector<peer_ptr> *targets);
+    void change_state(const peer_ptr &p, state_type new_state);
+    static const char *label(const peer_ptr &p);
 
+    //optional request is one an older server may not know; its answer
+    //has the given verb
+    void send_request(std::string request, answer_handler handler,
+                      peer_ptr p = nullptr, verb optional = verb::unknown);
+    void do_server_write();
+    void do_server_read();
+    void handle_server_line(std::string_view line);
+    //pending request of the answer, by id or the first untagged one;
+    //optional requests the server skipped are finished on the way
+    bool take_request(uint32_t id, verb title, server_request *request);
+    //forgets unanswered requests of the handler
+    void drop_requests(answer_handler handler);
+    void stream_list_answer();
     void send_connect();
-    void handle_connect(std::string answer);
+    void handle_connect(verb answer, token_cursor *tokens,
+                        const server_request &request);
+    void handle_features(verb answer, token_cursor *tokens,
+                         const server_request &request);
+    void handle_addresses(verb answer, token_cursor *tokens,
+                          const server_request &request);
     void send_get_list();
-    void handle_get_list(std::string answer);
-    void send_get_info();
-    void handle_get_info(std::string answer);
+    void handle_get_list(verb answer, token_cursor *tokens,
+                         const server_request &request);
+    //friends which are neither found nor looked up yet
+    size_t friends_to_look_up() const;
+    //looks up listed friends, stops at the last one missing
+    void look_up_listed(token_cursor *tokens);
+    void schedule_get_list();
+    void send_watch(const peer_ptr &p);
+    void start_watch_timer();
+    //server doesn't notify about registrations, friend list is polled
+    void poll_friends();
+    void handle_watch(verb answer, token_cursor *tokens,
+                      const server_request &request);
+    void handle_online(token_cursor *tokens);
+    void send_get_info(const peer_ptr &p);
+    void handle_get_info(verb answer, token_cursor *tokens,
+                         const server_request &request);
 
-    void activate_commutation(socket_ptr s);
-    void activate_socket(socket_ptr s);
+    void race_friend(const peer_ptr &p,
+                     std::vector<connection_race::candidate> candidates);
+    void punch_cached();
+    //cached endpoints led nowhere, the server lookup goes on
+    void drop_cached(const peer_ptr &p, const char *reason);
+    void cache_endpoints(const peer_ptr &p, const std::string &path);
+    //active side sends activate, friend of accepted socket (null) is told
+    //by its confirmation
+    void activate_commutation(socket_ptr s, peer_ptr p,
+                              const std::string &path);
+    //friend is looked up again when its activation fails
+    void retry_activation(const peer_ptr &p, const socket_ptr &s,
+                          const char *reason);
+    //passive side waits for activate with the friend name
+    void accept_activation(socket_ptr s);
+    void drop_available(const socket_ptr &s);
 
-    void start_commutation(socket_ptr s);
-    void do_friend_read();
-    void handle_friend_message(std::string message);
-    void do_friend_write();
+    void start_commutation(const peer_ptr &p, socket_ptr s, framer_ptr framer,
+                           const std::string &path);
+    void do_friend_read(const peer_ptr &p);
+    bool handle_friend_message(const peer_ptr &p, std::string_view message);
+    bool handle_friend_frame(const peer_ptr &p, uint8_t type,
+                             std::string_view payload);
+    bool handle_friend_command(const peer_ptr &p, verb title,
+                               token_cursor *tokens);
+    //parses arguments of the verb, a malformed command finishes the friend
+    template <typename Args>
+    bool dispatch_friend(const peer_ptr &p, verb title, token_cursor *tokens,
+                         bool (client::*handler)(const peer_ptr &,
+                                                 const Args &));
+    bool handle_message(const peer_ptr &p, const message_args &args);
+    bool handle_ping(const peer_ptr &p, const ping_args &args);
+    bool handle_bulk(const peer_ptr &p, const data_args &args);
+    //appends friend command in the given framing, args are joined
+    static void friend_command(std::string *out, bool binary, verb title,
+                               std::initializer_list<std::string_view> args);
+    void queue_friend_command(const peer_ptr &p, verb title,
+                              std::string_view args);
+    //message is formatted once per framing and copied to every queue
+    void fan_out(std::string_view text, const std::vector<peer_ptr> &targets,
+                 bool post_wake);
+    void schedule_heartbeat(const peer_ptr &p);
+    //link died without friend closing it: punch again or wait for friend
+    void link_lost(const peer_ptr &p, const std::string &reason);
+    void reset_link(const peer_ptr &p);
+    void start_link_bench(const peer_ptr &p);
+    void send_ping(const peer_ptr &p, uint64_t seq);
+    bool handle_pong(const peer_ptr &p, const pong_args &args);
+    void pump_bulk(const peer_ptr &p);
+    bool handle_bulk_end(const peer_ptr &p, const bulk_totals &args);
+    bool handle_bulk_done(const peer_ptr &p, const bulk_totals &args);
+    void drain_input();
+    void do_friend_write(const peer_ptr &p);
+    void continue_friend_write(const peer_ptr &p);
+    void print_write_stats();
+    void start_file_send(const peer_ptr &p, const std::string &path);
+    void send_file_chunk(const peer_ptr &p);
+    void continue_file_chunk(const peer_ptr &p);
+    void finish_file_send(const peer_ptr &p);
+    bool handle_file_begin(const peer_ptr &p, const file_begin_args &args);
+    bool handle_file_data(const peer_ptr &p, const data_args &args);
+    bool handle_file_end(const peer_ptr &p, const file_size_args &args);
+    bool handle_file_done(const peer_ptr &p, const file_size_args &args);
 
     bool start_acceptor();
+    void do_accept();
     void fill_private_endpoint();
 
-    void start_read(void(client::*handler)(std::string));
-    template <typename Buffer>
-    size_t read_complete(const Buffer &buf, boost::system::error_code ec,
-                         size_t bytes);
-    size_t read_complete_from_server(boost::system::error_code ec,
-                                     size_t bytes);
-    size_t read_complete_from_friend(boost::system::error_code ec,
-                                     size_t bytes);
-    template <typename Buffer>
-    void read(const Buffer &buf, std::function<void (std::string)> handler,
-              boost::system::error_code ec, size_t bytes);
-    void read_from_server(std::function<void(std::string)> handler,
-                          boost::system::error_code ec, size_t bytes);
-    void read_from_friend(std::function<void(std::string)> handler,
-                          boost::system::error_code ec, size_t bytes);
+    //handler is called with the next line, buffered or read from socket;
+    //socket and framer must be kept alive by the handler
+    //handler(boost::system::error_code, std::string_view)
+    template <typename Handler>
+    void read_line(boost::asio::ip::tcp::socket &s, line_framer &framer,
+                   handler_memory &memory, Handler handler);
+    //session ends when the last friend is gone
+    void close_peer(const peer_ptr &p);
+    void shutdown_peer(const peer_ptr &p);
     void close_all();
     //categorize clients to start communication
-    bool is_active_client() { return !friend_name.empty(); }
+    bool is_active_client() { return !friend_names.empty(); }
 
     static std::string to_string(boost::asio::ip::tcp::endpoint endpoint);
-    static std::string get_token(std::string *s);
+    static bool parse_endpoint(token_cursor *tokens,
+                               boost::asio::ip::tcp::endpoint *endpoint);
 };
 
 #endif // CLIENT_H
@@ -0,0 +1,165 @@
+#ifndef COMMAND_TABLE_H
+#define COMMAND_TABLE_H
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+
+//verbs of the server and friend protocols; first token of a line is
+//interned once and dispatched by switch, handlers never compare strings
+enum class verb : uint8_t
+{
+    unknown,
+    //server requests and answers
+    connect,
+    confirm_connection,
+    get_list,
+    list,
+    get_info,
+    info,
+    watch,
+    watching,
+    online,
+    error,
+    features,
+    //friend activation
+    activate,
+    confirm_activation,
+    //friend data, these have binary frame types
+    message,
+    ping,
+    pong,
+    bulk,
+    bulk_end,
+    bulk_done,
+    file_begin,
+    file_data,
+    file_end,
+    file_done,
+    heartbeat,
+    count
+};
+
+namespace command_table
+{
+
+constexpr std::string_view NAMES[] = {
+    "",
+    "connect",
+    "confirm_connection",
+    "get_list",
+    "list",
+    "get_info",
+    "info",
+    "watch",
+    "watching",
+    "online",
+    "error",
+    "features",
+    "activate",
+    "confirm_activation",
+    "message",
+    "ping",
+    "pong",
+    "bulk",
+    "bulk_end",
+    "bulk_done",
+    "file_begin",
+    "file_data",
+    "file_end",
+    "file_done",
+    "heartbeat",
+};
+static_assert(std::size(NAMES) == static_cast<size_t>(verb::count),
+              "verb without name");
+
+//binary frame types of friend data, index is the type on the wire
+constexpr verb FRAME_VERBS[] = {
+    verb::unknown, verb::message, verb::ping, verb::pong, verb::bulk,
+    verb::bulk_end, verb::bulk_done, verb::file_begin, verb::file_data,
+    verb::file_end, verb::file_done, verb::heartbeat
+};
+
+constexpr size_t TABLE_SIZE = 64;
+static_assert(TABLE_SIZE >= 2 * static_cast<size_t>(verb::count),
+              "table is too dense");
+
+//cheap enough for every line, collisions are resolved by probing
+constexpr uint32_t hash(std::string_view s)
+{
+    if (s.empty())
+    {
+        return 0;
+    }
+    return static_cast<uint32_t>(s.size()) * 31 +
+           static_cast<uint8_t>(s[s.size() > 1]) * 7 +
+           static_cast<uint8_t>(s.back());
+}
+
+//open addressing table of verbs built at compile time
+constexpr std::array<verb, TABLE_SIZE> build_table()
+{
+    std::array<verb, TABLE_SIZE> table{};
+    for (size_t v = 1; v < static_cast<size_t>(verb::count); ++v)
+    {
+        size_t slot = hash(NAMES[v]) % TABLE_SIZE;
+        while (table[slot] != verb::unknown)
+        {
+            slot = (slot + 1) % TABLE_SIZE;
+        }
+        table[slot] = static_cast<verb>(v);
+    }
+    return table;
+}
+
+constexpr std::array<verb, TABLE_SIZE> TABLE = build_table();
+
+}
+
+constexpr verb to_verb(std::string_view token)
+{
+    size_t slot = command_table::hash(token) % command_table::TABLE_SIZE;
+    while (command_table::TABLE[slot] != verb::unknown)
+    {
+        verb v = command_table::TABLE[slot];
+        if (command_table::NAMES[static_cast<size_t>(v)] == token)
+        {
+            return v;
+        }
+        slot = (slot + 1) % command_table::TABLE_SIZE;
+    }
+    return verb::unknown;
+}
+
+constexpr std::string_view verb_name(verb v)
+{
+    return command_table::NAMES[static_cast<size_t>(v)];
+}
+
+//frame type of friend data verb, 0 when it has none
+constexpr uint8_t frame_type(verb v)
+{
+    for (size_t i = 1; i < std::size(command_table::FRAME_VERBS); ++i)
+    {
+        if (command_table::FRAME_VERBS[i] == v)
+        {
+            return static_cast<uint8_t>(i);
+        }
+    }
+    return 0;
+}
+
+constexpr verb frame_verb(uint8_t type)
+{
+    return type < std::size(command_table::FRAME_VERBS) ?
+                command_table::FRAME_VERBS[type] : verb::unknown;
+}
+
+static_assert(to_verb("confirm_activation") == verb::confirm_activation &&
+              to_verb("bulk_done") == verb::bulk_done &&
+              to_verb("bulk_don") == verb::unknown &&
+              frame_verb(frame_type(verb::pong)) == verb::pong,
+              "command table is broken");
+
+#endif // COMMAND_TABLE_H
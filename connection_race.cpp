@@ -0,0 +1,265 @@
+#include "connection_race.h"
+#include "socket_options.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <boost/asio.hpp>
+#include <boost/date_time.hpp>
+
+#include <utility>
+#include <algorithm>
+
+using namespace std;
+using namespace boost::asio;
+using boost::asio::ip::tcp;
+using boost_error = boost::system::error_code;
+
+connection_race::ptr connection_race::create(io_service::strand strand,
+        vector<candidate> candidates, const options &opts)
+{
+    return ptr{new connection_race{strand, move(candidates), opts}};
+}
+
+connection_race::connection_race(io_service::strand strand,
+        vector<candidate> candidates, const options &opts) :
+    strand{strand},
+    list{move(candidates)},
+    opts(opts),
+    stagger_timer{strand.context()},
+    race_timer{strand.context()},
+    random{random_device{}()}
+{
+    slots.resize(list.size());
+    for (slot &sl : slots)
+    {
+        sl.timer.reset(new deadline_timer{strand.context()});
+        sl.retry_delay = opts.retry_delay;
+    }
+}
+
+void connection_race::start(win_handler on_win, attempt_handler on_failure,
+                            function<void()> on_all_failed)
+{
+    this->on_win = move(on_win);
+    this->on_failure = move(on_failure);
+    this->on_all_failed = move(on_all_failed);
+    if (list.empty())
+    {
+        finished = true;
+        this->on_all_failed();
+        return;
+    }
+    deadline = std::chrono::steady_clock::now() +
+            std::chrono::microseconds(opts.deadline.total_microseconds());
+    race_timer.expires_from_now(opts.deadline);
+    race_timer.async_wait(bind_executor(strand,
+        [self = shared_from_this()](boost_error ec)
+        {
+            if (!ec)
+            {
+                self->give_up();
+            }
+        }
+    ));
+    start_next();
+}
+
+void connection_race::cancel()
+{
+    finish(list.size());
+}
+
+void connection_race::start_next()
+{
+    if (finished || next == list.size())
+    {
+        return;
+    }
+
+    start_attempt(next++);
+    if (next == list.size())
+    {
+        return;
+    }
+
+    stagger_timer.expires_from_now(opts.stagger);
+    stagger_timer.async_wait(bind_executor(strand,
+        [self = shared_from_this()](boost_error ec)
+        {
+            if (!ec)
+            {
+                self->start_next();
+            }
+        }
+    ));
+}
+
+void connection_race::start_attempt(size_t index)
+{
+    slot &sl = slots[index];
+    sl.socket = make_shared<tcp::socket>(strand.context());
+    sl.attempt_start = std::chrono::steady_clock::now();
+    ++sl.attempts;
+    ++total_attempts;
+
+    const tcp::endpoint &endpoint = list[index].endpoint;
+    boost_error ec;
+    sl.socket->open(endpoint.protocol(), ec);
+    if (!ec)
+    {
+        //outgoing ports must not keep acceptors of other sessions from binding
+        share_local_port(*sl.socket, ec);
+    }
+    if (!ec && opts.local_port != 0)
+    {
+        sl.socket->bind(tcp::endpoint{endpoint.protocol(), opts.local_port},
+                        ec);
+    }
+    if (ec)
+    {
+        post(strand, [self = shared_from_this(), index, ec]
+                     { self->fail(index, ec); });
+        return;
+    }
+
+    sl.socket->async_connect(endpoint, bind_executor(strand,
+        [self = shared_from_this(), index, s = sl.socket](boost_error ec)
+        {
+            //socket of the cancelled attempt may be replaced already
+            if (self->finished || self->slots[index].socket != s)
+            {
+                return;
+            }
+            if (!ec)
+            {
+                self->finish(index);
+            }
+            else
+            {
+                self->fail(index, ec);
+            }
+        }
+    ));
+
+    //dropped SYN is retransmitted after a second and more, retry sooner
+    sl.timer->expires_from_now(opts.attempt_timeout);
+    sl.timer->async_wait(bind_executor(strand,
+        [self = shared_from_this(), index, s = sl.socket](boost_error ec)
+        {
+            if (!ec && !self->finished && self->slots[index].socket == s)
+            {
+                self->fail(index, error::timed_out);
+            }
+        }
+    ));
+}
+
+void connection_race::fail(size_t index, boost_error ec)
+{
+    if (finished)
+    {
+        return;
+    }
+
+    slot &sl = slots[index];
+    boost_error close_ec;
+    sl.socket->close(close_ec);
+    sl.socket.reset();
+    on_failure(list[index],
+               attempt{sl.attempts,
+                       std::chrono::steady_clock::now() - sl.attempt_start,
+                       ec});
+    schedule_retry(index);
+    if (finished)
+    {
+        return;
+    }
+
+    //do not wait for the stagger after a failure
+    if (next < list.size())
+    {
+        stagger_timer.cancel(close_ec);
+        start_next();
+    }
+}
+
+void connection_race::schedule_retry(size_t index)
+{
+    slot &sl = slots[index];
+
+    //equal jitter: half of the delay is fixed and half is random, so
+    //retries of both sides and of many sessions do not run in lockstep
+    int64_t delay = sl.retry_delay.total_microseconds();
+    int64_t jittered = delay / 2 +
+            uniform_int_distribution<int64_t>{0, delay / 2}(random);
+    sl.retry_delay = min(sl.retry_delay * 2, opts.max_retry_delay);
+
+    if (std::chrono::steady_clock::now() +
+            std::chrono::microseconds(jittered) >= deadline)
+    {
+        sl.given_up = true;
+        if (++given_up == list.size())
+        {
+            give_up();
+        }
+        return;
+    }
+
+    sl.timer->expires_from_now(boost::posix_time::microseconds(jittered));
+    sl.timer->async_wait(bind_executor(strand,
+        [self = shared_from_this(), index](boost_error ec)
+        {
+            if (!ec && !self->finished)
+            {
+                self->start_attempt(index);
+            }
+        }
+    ));
+}
+
+void connection_race::finish(size_t winner)
+{
+    if (finished)
+    {
+        return;
+    }
+    finished = true;
+
+    boost_error ec;
+    stagger_timer.cancel(ec);
+    race_timer.cancel(ec);
+    for (size_t i = 0; i < slots.size(); ++i)
+    {
+        slots[i].timer->cancel(ec);
+        if (i != winner && slots[i].socket)
+        {
+            slots[i].socket->close(ec);
+            slots[i].socket.reset();
+        }
+    }
+    if (winner < list.size())
+    {
+        slot &sl = slots[winner];
+        socket_ptr s = move(sl.socket);
+        on_win(s, list[winner],
+               attempt{sl.attempts,
+                       std::chrono::steady_clock::now() - sl.attempt_start,
+                       boost_error{}});
+    }
+}
+
+//closes attempts still in flight
+void connection_race::give_up()
+{
+    if (finished)
+    {
+        return;
+    }
+    finish(list.size());
+    on_all_failed();
+}
@@ -0,0 +1,122 @@
+#ifndef CONNECTION_RACE_H
+#define CONNECTION_RACE_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <random>
+#include <chrono>
+#include <functional>
+#include <boost/asio.hpp>
+#include <boost/date_time.hpp>
+
+//connects to candidate endpoints one after another with a stagger (next
+//one starts earlier when previous fails); failed candidates are retried
+//with jittered exponential delays until the deadline, because first SYNs
+//are dropped while friend NAT has no mapping yet, and an attempt without
+//answer is closed after a timeout instead of waiting for SYN backoff of
+//the kernel; the first established connection wins and every other
+//attempt is cancelled and closed
+class connection_race : public std::enable_shared_from_this<connection_race>
+{
+public:
+    struct candidate
+    {
+        boost::asio::ip::tcp::endpoint endpoint;
+        //"private", "public", "predicted"...
+        std::string kind;
+    };
+
+    struct options
+    {
+        boost::posix_time::time_duration stagger =
+                boost::posix_time::milliseconds(50);
+        //delay before the first retry, doubled up to max_retry_delay
+        boost::posix_time::time_duration retry_delay =
+                boost::posix_time::milliseconds(10);
+        boost::posix_time::time_duration max_retry_delay =
+                boost::posix_time::milliseconds(500);
+        //connect which got no answer is closed and retried after this
+        //long, so it must exceed the round trip to the friend
+        boost::posix_time::time_duration attempt_timeout =
+                boost::posix_time::milliseconds(500);
+        //attempts still in flight at the deadline are closed and the race
+        //fails
+        boost::posix_time::time_duration deadline =
+                boost::posix_time::seconds(5);
+        //outgoing sockets are bound to this port (0 - any), NAT maps
+        //the same port that friend was told about
+        uint16_t local_port = 0;
+    };
+
+    //outcome of one connect attempt
+    struct attempt
+    {
+        unsigned number;
+        std::chrono::steady_clock::duration elapsed;
+        boost::system::error_code ec;
+    };
+
+    using ptr = std::shared_ptr<connection_race>;
+    using socket_ptr = std::shared_ptr<boost::asio::ip::tcp::socket>;
+    using win_handler = std::function<void(socket_ptr, const candidate &,
+                                           const attempt &)>;
+    using attempt_handler = std::function<void(const candidate &,
+                                               const attempt &)>;
+
+    //handlers run on the strand of the caller
+    static ptr create(boost::asio::io_service::strand strand,
+                      std::vector<candidate> candidates, const options &opts);
+
+    //handlers are not called after cancel
+    void start(win_handler on_win, attempt_handler on_failure,
+               std::function<void()> on_all_failed);
+    void cancel();
+
+    const std::vector<candidate> &candidates() const { return list; }
+    unsigned attempts() const { return total_attempts; }
+
+private:
+    connection_race(boost::asio::io_service::strand strand,
+                    std::vector<candidate> candidates, const options &opts);
+
+    //connection state of one candidate
+    struct slot
+    {
+        socket_ptr socket;
+        //bounds the connect, then waits for the retry
+        std::unique_ptr<boost::asio::deadline_timer> timer;
+        std::chrono::steady_clock::time_point attempt_start;
+        unsigned attempts = 0;
+        boost::posix_time::time_duration retry_delay;
+        bool given_up = false;
+    };
+
+    boost::asio::io_service::strand strand;
+    std::vector<candidate> list;
+    std::vector<slot> slots;
+    options opts;
+    boost::asio::deadline_timer stagger_timer;
+    //fires at the deadline
+    boost::asio::deadline_timer race_timer;
+    std::chrono::steady_clock::time_point deadline;
+    std::minstd_rand random;
+    size_t next = 0;
+    size_t given_up = 0;
+    unsigned total_attempts = 0;
+    bool finished = false;
+
+    win_handler on_win;
+    attempt_handler on_failure;
+    std::function<void()> on_all_failed;
+
+    void start_next();
+    void start_attempt(size_t index);
+    void fail(size_t index, boost::system::error_code ec);
+    void schedule_retry(size_t index);
+    void finish(size_t winner);
+    void give_up();
+};
+
+#endif // CONNECTION_RACE_H
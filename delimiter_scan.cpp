@@ -0,0 +1,121 @@
+#include "delimiter_scan.h"
+
+#if (defined(__GNUC__) || defined(__clang__)) && \
+    (defined(__x86_64__) || (defined(__i386__) && defined(__SSE2__)))
+#define DELIMITER_SCAN_X86
+#include <immintrin.h>
+#endif
+
+const char *find_line_delimiter_scalar(const char *begin, const char *end)
+{
+    for (; begin != end; ++begin)
+    {
+        if (*begin == '\r' || *begin == '\n')
+        {
+            break;
+        }
+    }
+    return begin;
+}
+
+#ifdef DELIMITER_SCAN_X86
+
+const char *find_line_delimiter_sse2(const char *begin, const char *end)
+{
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    for (; end - begin >= 16; begin += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(begin));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr),
+                                                  _mm_cmpeq_epi8(v, lf)));
+        if (mask != 0)
+        {
+            return begin + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+    }
+    return find_line_delimiter_scalar(begin, end);
+}
+
+__attribute__((target("avx2")))
+static const char *avx2_scan(const char *begin, const char *end)
+{
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i lf = _mm256_set1_epi8('\n');
+    for (; end - begin >= 32; begin += 32)
+    {
+        __m256i v = _mm256_loadu_si256(
+                reinterpret_cast<const __m256i *>(begin));
+        int mask = _mm256_movemask_epi8(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, cr),
+                                _mm256_cmpeq_epi8(v, lf)));
+        if (mask != 0)
+        {
+            return begin + __builtin_ctz(static_cast<unsigned>(mask));
+        }
+    }
+    return find_line_delimiter_sse2(begin, end);
+}
+
+const char *find_line_delimiter_avx2(const char *begin, const char *end)
+{
+    return avx2_supported() ? avx2_scan(begin, end) :
+                              find_line_delimiter_sse2(begin, end);
+}
+
+bool sse2_supported()
+{
+    return true;
+}
+
+bool avx2_supported()
+{
+    static const bool supported = __builtin_cpu_supports("avx2");
+    return supported;
+}
+
+#else
+
+const char *find_line_delimiter_sse2(const char *begin, const char *end)
+{
+    return find_line_delimiter_scalar(begin, end);
+}
+
+const char *find_line_delimiter_avx2(const char *begin, const char *end)
+{
+    return find_line_delimiter_scalar(begin, end);
+}
+
+bool sse2_supported()
+{
+    return false;
+}
+
+bool avx2_supported()
+{
+    return false;
+}
+
+#endif
+
+using scanner = const char *(*)(const char *, const char *);
+
+static scanner select_scanner()
+{
+#ifdef DELIMITER_SCAN_X86
+    return avx2_supported() ? avx2_scan : find_line_delimiter_sse2;
+#else
+    return find_line_delimiter_scalar;
+#endif
+}
+
+const char *find_line_delimiter(const char *begin, const char *end)
+{
+    static const scanner scan = select_scanner();
+    return scan(begin, end);
+}
+
+const char *line_delimiter_scanner_name()
+{
+    return avx2_supported() ? "avx2" : sse2_supported() ? "sse2" : "scalar";
+}
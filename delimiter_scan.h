@@ -0,0 +1,16 @@
+#ifndef DELIMITER_SCAN_H
+#define DELIMITER_SCAN_H
+
+//first '\r' or '\n' in [begin, end), end if there is no one;
+//best implementation for the cpu is selected on first call
+const char *find_line_delimiter(const char *begin, const char *end);
+const char *line_delimiter_scanner_name();
+
+//particular implementations, unsupported ones fall back to scalar
+const char *find_line_delimiter_scalar(const char *begin, const char *end);
+const char *find_line_delimiter_sse2(const char *begin, const char *end);
+const char *find_line_delimiter_avx2(const char *begin, const char *end);
+bool sse2_supported();
+bool avx2_supported();
+
+#endif // DELIMITER_SCAN_H
@@ -0,0 +1,226 @@
+#include "file_transfer.h"
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <ostream>
+
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#ifdef __unix__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+
+using namespace std;
+
+//bytes of a file name most file systems take
+static const size_t MAX_NAME_SIZE = 255;
+
+void transfer_progress::start(uint64_t size, uint64_t now_ns)
+{
+    total = size;
+    done = 0;
+    start_ns = now_ns;
+    reported_tenths = 0;
+}
+
+bool transfer_progress::advance(uint64_t bytes)
+{
+    done += bytes;
+    unsigned tenths =
+        total == 0 ? 10 : static_cast<unsigned>(done * 10 / total);
+    if (tenths > reported_tenths)
+    {
+        reported_tenths = tenths;
+        return true;
+    }
+    return false;
+}
+
+void transfer_progress::report(ostream &out, const char *direction,
+                               const string &name, uint64_t now_ns) const
+{
+    double seconds = (now_ns - start_ns) / 1e9;
+    out << direction << " " << name << ": " <<
+           (total == 0 ? 100 : done * 100 / total) << "% (" << done <<
+           " of " << total << " bytes), " <<
+           (seconds > 0 ? done / seconds / 1e6 : 0) << " MB/s" << endl;
+}
+
+file_sender::~file_sender()
+{
+    close();
+}
+
+bool file_sender::open(const string &path, string *error)
+{
+#ifdef __linux__
+    close();
+    fd = ::open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        *error = fd < 0 ? strerror(errno) : "not a regular file";
+        close();
+        return false;
+    }
+    size_t slash = path.find_last_of('/');
+    file_name = slash == string::npos ? path : path.substr(slash + 1);
+    file_size = static_cast<uint64_t>(st.st_size);
+    offset = 0;
+    return true;
+#else
+    (void)path;
+    *error = "sendfile is not supported on this platform";
+    return false;
+#endif
+}
+
+void file_sender::close()
+{
+#ifdef __unix__
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+#endif
+    fd = -1;
+}
+
+long file_sender::send_to(int socket_fd, size_t bytes)
+{
+#ifdef __linux__
+    off_t off = static_cast<off_t>(offset);
+    ssize_t res = ::sendfile(socket_fd, fd, &off, bytes);
+    if (res < 0)
+    {
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ?
+                    0 : -1;
+    }
+    if (res == 0 && bytes != 0)
+    {
+        //file was truncated while it is sent
+        errno = EIO;
+        return -1;
+    }
+    offset += static_cast<uint64_t>(res);
+    return res;
+#else
+    (void)socket_fd;
+    (void)bytes;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+file_receiver::~file_receiver()
+{
+    close();
+}
+
+string file_receiver::local_name(string_view announced)
+{
+    announced = announced.substr(announced.find_last_of('/') + 1);
+    if (announced.empty() || announced == "." || announced == "..")
+    {
+        return string{};
+    }
+    string res = "received_";
+    res.append(announced.substr(0, MAX_NAME_SIZE - res.size()));
+    for (char &c : res)
+    {
+        if (static_cast<unsigned char>(c) < 0x20 || c == 0x7f || c == '\\')
+        {
+            c = '_';
+        }
+    }
+    return res;
+}
+
+bool file_receiver::open(const string &name, uint64_t size, string *error)
+{
+#ifdef __unix__
+    close();
+    if (size > static_cast<uint64_t>(numeric_limits<off_t>::max()) ||
+        size > numeric_limits<size_t>::max())
+    {
+        *error = "announced size is too big";
+        return false;
+    }
+    fd = ::open(name.c_str(),
+                O_RDWR | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        *error = strerror(errno);
+        return false;
+    }
+    //blocks are allocated now, a full disk fails here instead of raising
+    //SIGBUS on a write into the mapping
+    int res = size == 0 ? 0 : posix_fallocate(fd, 0, static_cast<off_t>(size));
+    if (res != 0)
+    {
+        *error = strerror(res);
+        close();
+        ::unlink(name.c_str());
+        return false;
+    }
+    if (size != 0)
+    {
+        void *p = mmap(nullptr, size, PROT_WRITE, MAP_SHARED, fd, 0);
+        if (p == MAP_FAILED)
+        {
+            *error = strerror(errno);
+            close();
+            return false;
+        }
+        map = static_cast<char *>(p);
+    }
+    file_name = name;
+    file_size = size;
+    offset = 0;
+    return true;
+#else
+    (void)name;
+    (void)size;
+    *error = "memory mapped files are not supported on this platform";
+    return false;
+#endif
+}
+
+void file_receiver::close()
+{
+#ifdef __unix__
+    if (map)
+    {
+        munmap(map, file_size);
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+#endif
+    map = nullptr;
+    fd = -1;
+}
+
+bool file_receiver::write(string_view data)
+{
+    if (data.size() > file_size - offset)
+    {
+        return false;
+    }
+    if (data.empty())
+    {
+        return true;
+    }
+    memcpy(map + offset, data.data(), data.size());
+    offset += data.size();
+    return true;
+}
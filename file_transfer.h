@@ -0,0 +1,96 @@
+#ifndef FILE_TRANSFER_H
+#define FILE_TRANSFER_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <ostream>
+
+//progress of one transfer, reported every tenth of the file
+class transfer_progress
+{
+public:
+    void start(uint64_t size, uint64_t now_ns);
+    //true when a new tenth is reached
+    bool advance(uint64_t bytes);
+    uint64_t bytes() const { return done; }
+    uint64_t size() const { return total; }
+
+    void report(std::ostream &out, const char *direction,
+                const std::string &name, uint64_t now_ns) const;
+
+private:
+    uint64_t total = 0;
+    uint64_t done = 0;
+    uint64_t start_ns = 0;
+    unsigned reported_tenths = 0;
+};
+
+//file which is sent from the page cache straight into a socket
+class file_sender
+{
+public:
+    file_sender() = default;
+    file_sender(const file_sender &) = delete;
+    file_sender &operator=(const file_sender &) = delete;
+    ~file_sender();
+
+    bool open(const std::string &path, std::string *error);
+    void close();
+    bool is_open() const { return fd >= 0; }
+
+    //file name without directories, as receiver stores it
+    const std::string &name() const { return file_name; }
+    uint64_t size() const { return file_size; }
+    uint64_t sent() const { return offset; }
+    bool finished() const { return offset == file_size; }
+
+    //sends up to bytes from the current offset to non-blocking socket fd;
+    //returns sent bytes, 0 when socket is full, -1 on error (errno)
+    long send_to(int socket_fd, size_t bytes);
+
+private:
+    int fd = -1;
+    std::string file_name;
+    uint64_t file_size = 0;
+    uint64_t offset = 0;
+};
+
+//file which is received into a pre-sized memory mapping
+class file_receiver
+{
+public:
+    file_receiver() = default;
+    file_receiver(const file_receiver &) = delete;
+    file_receiver &operator=(const file_receiver &) = delete;
+    ~file_receiver();
+
+    //file name in the current directory for the one friend announces:
+    //without directories and control characters, with received_ prefix;
+    //empty when nothing usable is left
+    static std::string local_name(std::string_view announced);
+
+    //creates file in the current directory, name must not contain path;
+    //disk space is reserved up front, so writes into the mapping can't
+    //fault, and a symbolic link in place of the file is refused
+    bool open(const std::string &name, uint64_t size, std::string *error);
+    //unmaps and closes, file is complete when everything was written
+    void close();
+    bool is_open() const { return fd >= 0; }
+
+    const std::string &name() const { return file_name; }
+    uint64_t size() const { return file_size; }
+    uint64_t received() const { return offset; }
+
+    //false when data exceeds the announced size
+    bool write(std::string_view data);
+
+private:
+    int fd = -1;
+    char *map = nullptr;
+    std::string file_name;
+    uint64_t file_size = 0;
+    uint64_t offset = 0;
+};
+
+#endif // FILE_TRANSFER_H
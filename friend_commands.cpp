@@ -0,0 +1,54 @@
+#include "friend_commands.h"
+
+#include <cstdint>
+#include <string_view>
+
+#include "token_cursor.h"
+
+using namespace std;
+
+bool parse_args(token_cursor *tokens, message_args *args)
+{
+    args->from = tokens->next();
+    args->text = tokens->rest();
+    return !args->from.empty() && !args->text.empty();
+}
+
+bool parse_args(token_cursor *tokens, ping_args *args)
+{
+    args->payload = tokens->rest();
+    return true;
+}
+
+bool parse_args(token_cursor *tokens, pong_args *args)
+{
+    return token_cursor::to_number(tokens->next(), &args->seq) &&
+           token_cursor::to_number(tokens->next(), &args->sent_ns);
+}
+
+bool parse_args(token_cursor *tokens, bulk_totals *args)
+{
+    return token_cursor::to_number(tokens->next(), &args->messages) &&
+           token_cursor::to_number(tokens->next(), &args->bytes);
+}
+
+bool parse_args(token_cursor *tokens, data_args *args)
+{
+    args->data = tokens->rest();
+    return true;
+}
+
+bool parse_args(token_cursor *tokens, file_begin_args *args)
+{
+    if (!token_cursor::to_number(tokens->next(), &args->size))
+    {
+        return false;
+    }
+    args->name = tokens->rest();
+    return !args->name.empty();
+}
+
+bool parse_args(token_cursor *tokens, file_size_args *args)
+{
+    return token_cursor::to_number(tokens->next(), &args->bytes);
+}
@@ -0,0 +1,65 @@
+#ifndef FRIEND_COMMANDS_H
+#define FRIEND_COMMANDS_H
+
+#include <cstdint>
+#include <string_view>
+
+class token_cursor;
+
+//arguments of friend commands, parsed before the handler of the verb runs,
+//so handlers get numbers and names instead of tokens; parse_args is false
+//for malformed ones
+
+struct message_args
+{
+    std::string_view from;
+    std::string_view text;
+};
+
+//ping payload goes back in pong as is
+struct ping_args
+{
+    std::string_view payload;
+};
+
+struct pong_args
+{
+    uint64_t seq = 0;
+    uint64_t sent_ns = 0;
+};
+
+//bulk_end of the sender and bulk_done of the receiver
+struct bulk_totals
+{
+    uint64_t messages = 0;
+    uint64_t bytes = 0;
+};
+
+//payload of bulk and file_data
+struct data_args
+{
+    std::string_view data;
+};
+
+struct file_begin_args
+{
+    uint64_t size = 0;
+    //as friend announces it, not a local path yet
+    std::string_view name;
+};
+
+//file_end announces the sent size, file_done the received one
+struct file_size_args
+{
+    uint64_t bytes = 0;
+};
+
+bool parse_args(token_cursor *tokens, message_args *args);
+bool parse_args(token_cursor *tokens, ping_args *args);
+bool parse_args(token_cursor *tokens, pong_args *args);
+bool parse_args(token_cursor *tokens, bulk_totals *args);
+bool parse_args(token_cursor *tokens, data_args *args);
+bool parse_args(token_cursor *tokens, file_begin_args *args);
+bool parse_args(token_cursor *tokens, file_size_args *args);
+
+#endif // FRIEND_COMMANDS_H
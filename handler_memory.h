@@ -0,0 +1,115 @@
+#ifndef HANDLER_MEMORY_H
+#define HANDLER_MEMORY_H
+
+#include <cstddef>
+#include <atomic>
+#include <new>
+#include <memory>
+#include <utility>
+#include <type_traits>
+
+//storage for the handler of one outstanding operation at a time; asio
+//allocates its operation objects here instead of the heap, another
+//allocation while it is in use falls back to operator new; operation is
+//freed on the io thread which completes it, outside of the strand which
+//allocates the next one, so the flag is atomic
+class handler_memory
+{
+public:
+    handler_memory() = default;
+    handler_memory(const handler_memory &) = delete;
+    handler_memory &operator=(const handler_memory &) = delete;
+
+    void *allocate(std::size_t size)
+    {
+        if (size <= sizeof(storage) &&
+            !in_use.exchange(true, std::memory_order_acquire))
+        {
+            return &storage;
+        }
+        return ::operator new(size);
+    }
+
+    void deallocate(void *p)
+    {
+        if (p == &storage)
+        {
+            in_use.store(false, std::memory_order_release);
+            return;
+        }
+        ::operator delete(p);
+    }
+
+private:
+    std::aligned_storage_t<512> storage;
+    std::atomic<bool> in_use{false};
+};
+
+//allocator which is associated with the wrapped handler
+template <typename T>
+class handler_allocator
+{
+public:
+    using value_type = T;
+
+    explicit handler_allocator(handler_memory &memory) : memory{memory} {}
+    template <typename U>
+    handler_allocator(const handler_allocator<U> &other) :
+        memory{other.memory}
+    {
+    }
+
+    T *allocate(std::size_t n)
+    {
+        return static_cast<T *>(memory.allocate(sizeof(T) * n));
+    }
+    void deallocate(T *p, std::size_t) { memory.deallocate(p); }
+
+    bool operator==(const handler_allocator &other) const
+    {
+        return &memory == &other.memory;
+    }
+    bool operator!=(const handler_allocator &other) const
+    {
+        return &memory != &other.memory;
+    }
+
+private:
+    template <typename> friend class handler_allocator;
+    handler_memory &memory;
+};
+
+template <typename Handler>
+class custom_alloc_handler
+{
+public:
+    using allocator_type = handler_allocator<Handler>;
+
+    custom_alloc_handler(handler_memory &memory, Handler handler) :
+        memory{memory},
+        handler{std::move(handler)}
+    {
+    }
+
+    allocator_type get_allocator() const { return allocator_type{memory}; }
+
+    template <typename ...Args>
+    void operator()(Args &&...args)
+    {
+        handler(std::forward<Args>(args)...);
+    }
+
+private:
+    handler_memory &memory;
+    Handler handler;
+};
+
+//handler whose operation lives in memory, memory must outlive it
+template <typename Handler>
+inline custom_alloc_handler<Handler> make_custom_alloc_handler(
+        handler_memory &memory, Handler handler)
+{
+    return custom_alloc_handler<Handler>{memory, std::move(handler)};
+}
+
+#endif // HANDLER_MEMORY_H
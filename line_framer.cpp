@@ -0,0 +1,208 @@
+#include "line_framer.h"
+#include "delimiter_scan.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <initializer_list>
+#include <boost/asio.hpp>
+
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+using namespace boost::asio;
+
+static bool is_delimiter(char c)
+{
+    return c == '\r' || c == '\n';
+}
+
+line_framer::line_framer(size_t max_line_size) :
+    max_line_size{max_line_size}
+{
+}
+
+mutable_buffers_1 line_framer::prepare(size_t size)
+{
+    if (buf.size() - end_pos < size)
+    {
+        //move unconsumed bytes to the front before growing
+        if (begin_pos != 0)
+        {
+            memmove(buf.data(), buf.data() + begin_pos, end_pos - begin_pos);
+            scan_pos -= begin_pos;
+            end_pos -= begin_pos;
+            begin_pos = 0;
+        }
+        if (buf.size() - end_pos < size)
+        {
+            buf.resize(max(end_pos + size, buf.size() * 2));
+        }
+    }
+    return buffer(buf.data() + end_pos, buf.size() - end_pos);
+}
+
+void line_framer::commit(size_t bytes)
+{
+    end_pos += min(bytes, buf.size() - end_pos);
+}
+
+bool line_framer::next_line(string_view *line)
+{
+    skip_lf();
+    skip_delimiters();
+
+    const char *begin = buf.data() + scan_pos;
+    const char *end = buf.data() + end_pos;
+    const char *it = find_line_delimiter(begin, end);
+    if (it == end)
+    {
+        scan_pos = end_pos;
+        too_long = end_pos - begin_pos > max_line_size;
+        return false;
+    }
+
+    size_t line_end = it - buf.data();
+    *line = string_view{buf.data() + begin_pos, line_end - begin_pos};
+    //consume exactly one terminator, binary frames may follow it
+    begin_pos = line_end + 1;
+    pending_lf = *it == '\r';
+    skip_lf();
+    scan_pos = begin_pos;
+    reset_if_empty();
+    return true;
+}
+
+bool line_framer::next_frame(uint8_t *type, string_view *payload)
+{
+    skip_lf();
+    needed = 0;
+
+    //varint length of type and payload
+    uint64_t length = 0;
+    size_t pos = begin_pos;
+    for (int shift = 0; ; shift += 7)
+    {
+        if (pos == end_pos)
+        {
+            needed = 1;
+            return false;
+        }
+        uint8_t byte = static_cast<uint8_t>(buf[pos++]);
+        length |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+        {
+            break;
+        }
+        if (shift >= 28)
+        {
+            too_long = true;
+            return false;
+        }
+    }
+    if (length == 0 || length > max_line_size)
+    {
+        too_long = true;
+        return false;
+    }
+    if (end_pos - pos < length)
+    {
+        needed = length - (end_pos - pos);
+        return false;
+    }
+
+    *type = static_cast<uint8_t>(buf[pos]);
+    *payload = string_view{buf.data() + pos + 1, length - 1};
+    begin_pos = scan_pos = pos + length;
+    reset_if_empty();
+    return true;
+}
+
+bool line_framer::overflow() const
+{
+    return too_long;
+}
+
+string_view line_framer::partial_line() const
+{
+    return string_view{buf.data() + begin_pos, end_pos - begin_pos};
+}
+
+void line_framer::consume_partial(size_t bytes)
+{
+    begin_pos += min(bytes, end_pos - begin_pos);
+    scan_pos = max(scan_pos, begin_pos);
+    too_long = end_pos - begin_pos > max_line_size;
+}
+
+void line_framer::skip_lf()
+{
+    if (pending_lf && begin_pos != end_pos)
+    {
+        if (buf[begin_pos] == '\n')
+        {
+            ++begin_pos;
+            scan_pos = max(scan_pos, begin_pos);
+        }
+        pending_lf = false;
+    }
+}
+
+void line_framer::skip_delimiters()
+{
+    if (scan_pos != begin_pos)
+    {
+        return;
+    }
+
+    while (begin_pos != end_pos && is_delimiter(buf[begin_pos]))
+    {
+        ++begin_pos;
+    }
+    scan_pos = begin_pos;
+    reset_if_empty();
+}
+
+void line_framer::reset_if_empty()
+{
+    if (begin_pos == end_pos)
+    {
+        begin_pos = scan_pos = end_pos = 0;
+    }
+}
+
+string encode_frame(uint8_t type, string_view payload)
+{
+    string frame;
+    append_frame(&frame, type, {payload});
+    return frame;
+}
+
+void append_frame_header(string *frame, uint8_t type, size_t payload_size)
+{
+    uint64_t length = payload_size + 1;
+    do
+    {
+        uint8_t byte = length & 0x7f;
+        length >>= 7;
+        frame->push_back(static_cast<char>(length != 0 ? byte | 0x80 : byte));
+    } while (length != 0);
+    frame->push_back(static_cast<char>(type));
+}
+
+void append_frame(string *frame, uint8_t type,
+                  initializer_list<string_view> payload)
+{
+    size_t size = 0;
+    for (string_view part : payload)
+    {
+        size += part.size();
+    }
+    frame->reserve(frame->size() + size + 6);
+    append_frame_header(frame, type, size);
+    for (string_view part : payload)
+    {
+        frame->append(part.data(), part.size());
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef LINE_FRAMER_H
+#define LINE_FRAMER_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <vector>
+#include <initializer_list>
+#include <boost/asio.hpp>
+
+//splits stream into "\r\n" (or "\n") terminated lines or binary frames
+//(varint length of type and payload, type byte, payload); bytes after a
+//line or frame stay in the buffer and every byte is scanned only once
+class line_framer
+{
+public:
+    static constexpr size_t MIN_READ_SIZE = 1024;
+    static constexpr size_t DEFAULT_MAX_LINE_SIZE = 64 * 1024;
+
+    explicit line_framer(size_t max_line_size = DEFAULT_MAX_LINE_SIZE);
+
+    //free space for next read, valid until next call of any method
+    boost::asio::mutable_buffers_1 prepare(size_t size = MIN_READ_SIZE);
+    void commit(size_t bytes);
+
+    //extract next complete line without terminator,
+    //line is valid until next call of prepare
+    bool next_line(std::string_view *line);
+    //extract next complete frame, payload is valid until next prepare
+    bool next_frame(uint8_t *type, std::string_view *payload);
+    //bytes still missing for the frame at the front, it can be read at once
+    size_t frame_bytes_needed() const { return needed; }
+
+    //received part of the line which is not complete yet (after next_line
+    //returned false), so very long lines can be parsed as they arrive;
+    //consumed bytes are dropped from the front of that line, the last one
+    //must stay until the terminator comes
+    std::string_view partial_line() const;
+    void consume_partial(size_t bytes);
+
+    //line or frame is longer than max line size or frame is invalid
+    bool overflow() const;
+
+    size_t buffered() const { return end_pos - begin_pos; }
+
+private:
+    std::vector<char> buf;
+    size_t begin_pos = 0;
+    size_t scan_pos = 0;
+    size_t end_pos = 0;
+    size_t max_line_size;
+    size_t needed = 0;
+    bool too_long = false;
+    //line ended with '\r', its '\n' is not read yet
+    bool pending_lf = false;
+
+    void skip_lf();
+    void skip_delimiters();
+    void reset_if_empty();
+};
+
+std::string encode_frame(uint8_t type, std::string_view payload);
+//appends length and type of a frame whose payload is written separately
+void append_frame_header(std::string *frame, uint8_t type, size_t payload_size);
+//appends frame with the payload joined from parts
+void append_frame(std::string *frame, uint8_t type,
+                  std::initializer_list<std::string_view> payload);
+
+#endif // LINE_FRAMER_H
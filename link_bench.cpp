@@ -0,0 +1,67 @@
+#include "link_bench.h"
+#include "percentiles.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+
+using namespace std;
+
+bool link_bench::parse_mode(const string &name, mode *m)
+{
+    if (name == "ping")
+    {
+        *m = mode::ping;
+    }
+    else if (name == "bulk")
+    {
+        *m = mode::bulk;
+    }
+    else if (name == "all")
+    {
+        *m = mode::all;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+void link_bench::start_bulk(uint64_t now_ns)
+{
+    bulk_active = true;
+    bulk_start_ns = now_ns;
+    bulk_sent = 0;
+    bulk_end_sent = false;
+}
+
+void link_bench::finish_bulk(uint64_t now_ns, uint64_t bytes)
+{
+    bulk_active = false;
+    bulk_finish_ns = now_ns;
+    bulk_bytes = bytes;
+}
+
+void link_bench::receive_bulk(size_t bytes)
+{
+    ++received;
+    received_total += bytes;
+}
+
+void link_bench::report_ping(ostream &out, const string &path) const
+{
+    out << "ping over " << path << " endpoint, " << opts.size <<
+           " bytes payload: " <<
+           percentiles::calculate(rtts).to_string("us") << endl;
+}
+
+void link_bench::report_bulk(ostream &out, const string &path) const
+{
+    double seconds = (bulk_finish_ns - bulk_start_ns) / 1e9;
+    out << "bulk over " << path << " endpoint, " << opts.size <<
+           " bytes payload: " << bulk_bytes << " bytes in " << seconds <<
+           " s, " << (seconds > 0 ? bulk_bytes / seconds / 1e6 : 0) <<
+           " MB/s" << endl;
+}
@@ -0,0 +1,64 @@
+#ifndef LINK_BENCH_H
+#define LINK_BENCH_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ostream>
+
+//ping/pong round trips and bulk throughput over the friend connection
+class link_bench
+{
+public:
+    enum class mode {none, ping, bulk, all};
+    struct options
+    {
+        mode test = mode::none;
+        //payload bytes of every ping and bulk message
+        size_t size = 64;
+        size_t count = 1000;
+    };
+
+    static bool parse_mode(const std::string &name, mode *m);
+
+    void configure(const options &opts) { this->opts = opts; }
+    const options &config() const { return opts; }
+    bool enabled() const { return opts.test != mode::none; }
+    bool ping_enabled() const
+    { return opts.test == mode::ping || opts.test == mode::all; }
+    bool bulk_enabled() const
+    { return opts.test == mode::bulk || opts.test == mode::all; }
+
+    //sender side
+    std::string payload() const { return std::string(opts.size, 'x'); }
+    void add_rtt(uint64_t ns) { rtts.push_back(ns / 1e3); }
+    size_t rtt_count() const { return rtts.size(); }
+    void start_bulk(uint64_t now_ns);
+    bool bulk_running() const { return bulk_active; }
+    size_t bulk_sent = 0;
+    bool bulk_end_sent = false;
+    void finish_bulk(uint64_t now_ns, uint64_t bytes);
+
+    //receiver side
+    void receive_bulk(size_t bytes);
+    uint64_t received_messages() const { return received; }
+    uint64_t received_bytes() const { return received_total; }
+    void reset_received() { received = received_total = 0; }
+
+    void report_ping(std::ostream &out, const std::string &path) const;
+    void report_bulk(std::ostream &out, const std::string &path) const;
+
+private:
+    options opts;
+    std::vector<double> rtts;
+
+    bool bulk_active = false;
+    uint64_t bulk_start_ns = 0;
+    uint64_t bulk_finish_ns = 0;
+    uint64_t bulk_bytes = 0;
+
+    uint64_t received = 0;
+    uint64_t received_total = 0;
+};
+
+#endif // LINK_BENCH_H
@@ -0,0 +1,121 @@
+#include "load_generator.h"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <boost/asio.hpp>
+
+#include <iostream>
+#include <utility>
+#include <algorithm>
+
+using namespace std;
+using namespace boost::asio;
+
+load_generator::load_generator(string name_prefix,
+                               string server_ip, uint16_t server_port,
+                               size_t sessions, size_t threads) :
+    thread_count{max<size_t>(1, min(threads, max<size_t>(1, sessions)))},
+    service{static_cast<int>(thread_count)},
+    work{new io_service::work{service}}
+{
+
+    start_times.resize(sessions);
+    latencies.reset(new atomic<int64_t>[sessions]);
+    clients.reserve(sessions);
+    for (size_t i = 0; i < sessions; ++i)
+    {
+        string friend_name = load_generator::friend_name(name_prefix, i,
+                                                         sessions);
+        client::ptr cl = client::create(service, session_name(name_prefix, i),
+                server_ip, server_port,
+                friend_name.empty() ? vector<string>{} :
+                                      vector<string>{friend_name});
+        latencies[i] = 0;
+        cl->set_communication_handler(
+            [this, i]
+            {
+                latencies[i] =
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        clock::now() - start_times[i]).count();
+                ++communicating_count;
+            }
+        );
+        cl->set_close_handler([this]{ ++closed_count; });
+        clients.push_back(move(cl));
+    }
+}
+
+load_generator::~load_generator()
+{
+    stop();
+}
+
+void load_generator::start()
+{
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+        start_times[i] = clock::now();
+        clients[i]->start();
+    }
+
+    for (size_t i = 0; i < thread_count; ++i)
+    {
+        threads.emplace_back(
+            [this]
+            {
+                try
+                {
+                    service.run();
+                }
+                catch (exception &e)
+                {
+                    cerr << "Exception: " << e.what() << endl;
+                }
+            }
+        );
+    }
+}
+
+void load_generator::stop()
+{
+    work.reset();
+    service.stop();
+    for (auto &t : threads)
+    {
+        if (t.joinable())
+        {
+            t.join();
+        }
+    }
+    threads.clear();
+}
+
+vector<double> load_generator::communication_latencies() const
+{
+    vector<double> res;
+    for (size_t i = 0; i < clients.size(); ++i)
+    {
+        if (int64_t ns = latencies[i])
+        {
+            res.push_back(ns / 1e6);
+        }
+    }
+    return res;
+}
+
+string load_generator::session_name(const string &prefix, size_t index)
+{
+    return prefix + "_" + std::to_string(index);
+}
+
+string load_generator::friend_name(const string &prefix, size_t index,
+                                   size_t sessions)
+{
+    if (index % 2 == 0 && index + 1 < sessions)
+    {
+        return session_name(prefix, index + 1);
+    }
+    return "";
+}
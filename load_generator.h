@@ -0,0 +1,56 @@
+#ifndef LOAD_GENERATOR_H
+#define LOAD_GENERATOR_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <boost/asio.hpp>
+
+#include "client.h"
+
+//runs many client sessions in one process on a shared pool of io threads
+class load_generator
+{
+public:
+    load_generator(std::string name_prefix,
+                   std::string server_ip, uint16_t server_port,
+                   size_t sessions, size_t threads);
+    ~load_generator();
+
+    void start();
+    void stop();
+
+    size_t sessions() const { return clients.size(); }
+    size_t communicating() const { return communicating_count; }
+    size_t closed() const { return closed_count; }
+    //milliseconds from session start to communication with friend
+    std::vector<double> communication_latencies() const;
+
+    //session names are <prefix>_<index>, even sessions look for the next odd
+    static std::string session_name(const std::string &prefix, size_t index);
+    static std::string friend_name(const std::string &prefix, size_t index,
+                                   size_t sessions);
+
+private:
+    using work_ptr = std::unique_ptr<boost::asio::io_service::work>;
+
+    //sessions share one service, each is serialized by its own strand
+    size_t thread_count;
+    boost::asio::io_service service;
+    work_ptr work;
+    std::vector<std::thread> threads;
+    std::vector<client::ptr> clients;
+
+    using clock = std::chrono::steady_clock;
+    std::vector<clock::time_point> start_times;
+    //nanoseconds to communication, 0 until session reaches it
+    std::unique_ptr<std::atomic<int64_t>[]> latencies;
+
+    std::atomic<size_t> communicating_count{0};
+    std::atomic<size_t> closed_count{0};
+};
+
+#endif // LOAD_GENERATOR_H
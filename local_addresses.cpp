@@ -0,0 +1,204 @@
+#include "local_addresses.h"
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <boost/asio.hpp>
+
+#include <array>
+#include <cstring>
+#include <algorithm>
+
+#ifdef __unix__
+#include <sys/types.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#endif
+#ifdef __linux__
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace boost::asio;
+using boost_error = boost::system::error_code;
+
+static mutex cache_mutex;
+static bool cache_loaded = false;
+static vector<ip::address> cache;
+
+vector<ip::address> local_addresses::get()
+{
+    lock_guard<mutex> lock{cache_mutex};
+    if (!cache_loaded)
+    {
+        cache = enumerate();
+        cache_loaded = true;
+    }
+    return cache;
+}
+
+void local_addresses::refresh()
+{
+    vector<ip::address> addresses = enumerate();
+    lock_guard<mutex> lock{cache_mutex};
+    cache = move(addresses);
+    cache_loaded = true;
+}
+
+static bool usable(const ip::address &address)
+{
+    if (address.is_loopback() || address.is_unspecified())
+    {
+        return false;
+    }
+    return !address.is_v6() || !address.to_v6().is_link_local();
+}
+
+vector<ip::address> local_addresses::enumerate()
+{
+    vector<ip::address> res;
+#ifdef __unix__
+    ifaddrs *list = nullptr;
+    if (getifaddrs(&list) != 0)
+    {
+        return res;
+    }
+    for (ifaddrs *it = list; it != nullptr; it = it->ifa_next)
+    {
+        if (it->ifa_addr == nullptr || (it->ifa_flags & IFF_UP) == 0 ||
+            (it->ifa_flags & IFF_LOOPBACK) != 0)
+        {
+            continue;
+        }
+
+        ip::address address;
+        if (it->ifa_addr->sa_family == AF_INET)
+        {
+            auto *sa = reinterpret_cast<sockaddr_in *>(it->ifa_addr);
+            ip::address_v4::bytes_type bytes;
+            memcpy(bytes.data(), &sa->sin_addr, bytes.size());
+            address = ip::address_v4{bytes};
+        }
+        else if (it->ifa_addr->sa_family == AF_INET6)
+        {
+            auto *sa = reinterpret_cast<sockaddr_in6 *>(it->ifa_addr);
+            ip::address_v6::bytes_type bytes;
+            memcpy(bytes.data(), &sa->sin6_addr, bytes.size());
+            address = ip::address_v6{bytes};
+        }
+        else
+        {
+            continue;
+        }
+        if (usable(address) && find(res.begin(), res.end(), address) ==
+                               res.end())
+        {
+            res.push_back(address);
+        }
+    }
+    freeifaddrs(list);
+#else
+    //no interface enumeration here, resolve own host name once instead
+    io_service service;
+    ip::tcp::resolver resolver{service};
+    boost_error ec;
+    auto it = resolver.resolve({ip::host_name(), ""}, ec);
+    for (; !ec && it != ip::tcp::resolver::iterator{}; ++it)
+    {
+        ip::address address = it->endpoint().address();
+        if (usable(address) && find(res.begin(), res.end(), address) ==
+                               res.end())
+        {
+            res.push_back(address);
+        }
+    }
+#endif
+    stable_partition(res.begin(), res.end(),
+                     [](const ip::address &a){ return a.is_v4(); });
+    return res;
+}
+
+#ifdef __linux__
+
+namespace
+{
+
+//reads route netlink notifications and refreshes the cache on each one
+class netlink_watcher : public enable_shared_from_this<netlink_watcher>
+{
+public:
+    netlink_watcher(io_service &service, int fd) :
+        descriptor{service, fd}
+    {
+    }
+
+    void start()
+    {
+        descriptor.async_read_some(buffer(buf),
+            [self = shared_from_this()](boost_error ec, size_t)
+            {
+                if (!ec)
+                {
+                    local_addresses::refresh();
+                    self->start();
+                }
+            }
+        );
+    }
+
+private:
+    posix::stream_descriptor descriptor;
+    array<char, 8192> buf;
+};
+
+}
+
+void local_addresses::watch()
+{
+    static atomic<bool> started{false};
+    if (started.exchange(true))
+    {
+        return;
+    }
+
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0)
+    {
+        return;
+    }
+    sockaddr_nl sa = {};
+    sa.nl_family = AF_NETLINK;
+    sa.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+    if (bind(fd, reinterpret_cast<sockaddr *>(&sa), sizeof(sa)) != 0)
+    {
+        close(fd);
+        return;
+    }
+    //own service, so the pending read never keeps a session service running
+    static io_service service;
+    make_shared<netlink_watcher>(service, fd)->start();
+    //joined at exit before the service above is destroyed
+    static struct watch_thread
+    {
+        thread t;
+        ~watch_thread()
+        {
+            service.stop();
+            t.join();
+        }
+    } runner{thread{[]{ service.run(); }}};
+}
+
+#else
+
+void local_addresses::watch()
+{
+}
+
+#endif
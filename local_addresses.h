@@ -0,0 +1,22 @@
+#ifndef LOCAL_ADDRESSES_H
+#define LOCAL_ADDRESSES_H
+
+#include <vector>
+#include <boost/asio.hpp>
+
+//usable (up, not loopback, not link-local) addresses of local interfaces;
+//enumerated once per process, IPv4 ones go first
+class local_addresses
+{
+public:
+    static std::vector<boost::asio::ip::address> get();
+    static void refresh();
+    //refresh the cache when interfaces change, once per process; runs on
+    //own thread, which is joined at exit
+    static void watch();
+
+private:
+    static std::vector<boost::asio::ip::address> enumerate();
+};
+
+#endif // LOCAL_ADDRESSES_H
@@ -0,0 +1,442 @@
+#include "log_sink.h"
+
+#include <cstdio>
+#include <cerrno>
+#include <iostream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+
+#ifdef __unix__
+#include <unistd.h>
+#endif
+
+#include "spsc_ring.h"
+
+using namespace std;
+
+namespace
+{
+
+//output is written when this much is collected or queues are empty
+const size_t FLUSH_BYTES = 256 * 1024;
+//bound of a missed wakeup, producers don't lock to notify the writer
+const auto IDLE_WAIT = std::chrono::milliseconds(10);
+
+struct log_record
+{
+    uint64_t unix_ns = 0;
+    log_level level = log_level::info;
+    string text;
+};
+
+//queue of one producer thread, kept by the writer until it is drained
+struct producer
+{
+    producer(size_t lines, unsigned id) : ring{lines}, id{id} {}
+
+    spsc_ring<log_record> ring;
+    atomic<uint64_t> dropped{0};
+    unsigned id;
+};
+
+//appends to a string which keeps its capacity from line to line
+class string_buf : public streambuf
+{
+public:
+    string text;
+
+protected:
+    int_type overflow(int_type c) override
+    {
+        if (!traits_type::eq_int_type(c, traits_type::eof()))
+        {
+            text.push_back(traits_type::to_char_type(c));
+        }
+        return traits_type::not_eof(c);
+    }
+
+    streamsize xsputn(const char *s, streamsize n) override
+    {
+        text.append(s, static_cast<size_t>(n));
+        return n;
+    }
+};
+
+struct line_builder
+{
+    string_buf buf;
+    ostream out{&buf};
+};
+
+log_sink::options sink_options;
+atomic<bool> running{false};
+atomic<uint8_t> min_level{static_cast<uint8_t>(log_level::info)};
+
+mutex producers_mutex;
+vector<shared_ptr<producer>> producers;
+//changed on registration, so the writer copies the list only then
+atomic<unsigned> generation{0};
+//start count, thread queues of a previous start are registered again
+atomic<unsigned> epoch{0};
+uint64_t retired_drops = 0;
+
+thread writer_thread;
+mutex wake_mutex;
+condition_variable wake;
+atomic<bool> writer_sleeping{false};
+
+line_builder &builder()
+{
+    thread_local line_builder b;
+    return b;
+}
+
+producer *local_producer()
+{
+    thread_local shared_ptr<producer> local;
+    thread_local unsigned local_epoch = 0;
+    unsigned e = epoch.load(memory_order_acquire);
+    if (!local || local_epoch != e)
+    {
+        lock_guard<mutex> lock{producers_mutex};
+        static unsigned next_id = 0;
+        local = make_shared<producer>(sink_options.queue_lines, ++next_id);
+        local_epoch = e;
+        producers.push_back(local);
+        generation.fetch_add(1, memory_order_release);
+    }
+    return local.get();
+}
+
+uint64_t unix_now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+void write_out(string *out)
+{
+    size_t written = 0;
+#ifdef __unix__
+    while (written < out->size())
+    {
+        ssize_t bytes = ::write(STDOUT_FILENO, out->data() + written,
+                                out->size() - written);
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            break;
+        }
+        written += static_cast<size_t>(bytes);
+    }
+#else
+    fwrite(out->data(), 1, out->size(), stdout);
+    fflush(stdout);
+#endif
+    out->clear();
+}
+
+void append_json_string(string *out, const string &s)
+{
+    static const char HEX[] = "0123456789abcdef";
+    out->push_back('"');
+    for (char c : s)
+    {
+        switch (c)
+        {
+        case '"': out->append("\\\""); break;
+        case '\\': out->append("\\\\"); break;
+        case '\n': out->append("\\n"); break;
+        case '\r': out->append("\\r"); break;
+        case '\t': out->append("\\t"); break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20)
+            {
+                out->append("\\u00");
+                out->push_back(HEX[(c >> 4) & 0xf]);
+                out->push_back(HEX[c & 0xf]);
+            }
+            else
+            {
+                out->push_back(c);
+            }
+        }
+    }
+    out->push_back('"');
+}
+
+void format(const log_record &r, unsigned thread_id, string *out)
+{
+    if (!sink_options.json)
+    {
+        out->append(r.text);
+        out->push_back('\n');
+        return;
+    }
+    out->append("{\"ts_ns\":");
+    out->append(to_string(r.unix_ns));
+    out->append(",\"level\":\"");
+    out->append(log_sink::level_name(r.level));
+    out->append("\",\"thread\":");
+    out->append(to_string(thread_id));
+    out->append(",\"msg\":");
+    append_json_string(out, r.text);
+    out->append("}\n");
+}
+
+uint64_t count_drops(const vector<shared_ptr<producer>> &list)
+{
+    uint64_t drops = 0;
+    for (auto &p : list)
+    {
+        drops += p->dropped.load(memory_order_relaxed);
+    }
+    return drops;
+}
+
+//queues of finished threads are forgotten once drained; the writer drops
+//its copy of the list first, so only the registry references them
+void prune_producers()
+{
+    lock_guard<mutex> lock{producers_mutex};
+    //dead ones are kept at the end, their drops are counted below
+    auto dead = partition(producers.begin(), producers.end(),
+        [](const shared_ptr<producer> &p)
+        {
+            return p.use_count() > 1 || !p->ring.empty();
+        });
+    if (dead == producers.end())
+    {
+        return;
+    }
+    for (auto it = dead; it != producers.end(); ++it)
+    {
+        retired_drops += (*it)->dropped.load(memory_order_relaxed);
+    }
+    producers.erase(dead, producers.end());
+    generation.fetch_add(1, memory_order_release);
+}
+
+void run_writer()
+{
+    string out;
+    out.reserve(FLUSH_BYTES + 4096);
+    vector<shared_ptr<producer>> list;
+    unsigned seen_generation = generation.load(memory_order_acquire) - 1;
+    uint64_t reported_drops = 0;
+    uint64_t retired = 0;
+    auto copy_producers = [&list, &retired, &seen_generation]
+    {
+        lock_guard<mutex> lock{producers_mutex};
+        list = producers;
+        retired = retired_drops;
+        seen_generation = generation.load(memory_order_acquire);
+    };
+
+    for (;;)
+    {
+        //stop is seen before the last drain, so nothing queued is lost
+        bool stopping = !running.load(memory_order_acquire);
+        if (generation.load(memory_order_acquire) != seen_generation)
+        {
+            copy_producers();
+        }
+
+        size_t taken = 0;
+        for (auto &p : list)
+        {
+            taken += p->ring.consume([&out, &p](log_record &r)
+            {
+                format(r, p->id, &out);
+                if (out.size() >= FLUSH_BYTES)
+                {
+                    write_out(&out);
+                }
+                return true;
+            });
+        }
+
+        uint64_t drops = retired + count_drops(list);
+        if (drops != reported_drops)
+        {
+            log_record r;
+            r.unix_ns = unix_now();
+            r.level = log_level::warning;
+            r.text = "log: " + to_string(drops - reported_drops) +
+                     " lines dropped";
+            format(r, 0, &out);
+            reported_drops = drops;
+        }
+        if (!out.empty())
+        {
+            write_out(&out);
+        }
+        if (stopping)
+        {
+            break;
+        }
+        if (taken > 0)
+        {
+            continue;
+        }
+
+        list.clear();
+        prune_producers();
+        copy_producers();
+        unique_lock<mutex> lock{wake_mutex};
+        writer_sleeping.store(true);
+        atomic_thread_fence(memory_order_seq_cst);
+        bool idle = all_of(list.begin(), list.end(),
+            [](const shared_ptr<producer> &p){ return p->ring.empty(); });
+        if (idle && running.load(memory_order_acquire))
+        {
+            wake.wait_for(lock, IDLE_WAIT);
+        }
+        writer_sleeping.store(false);
+    }
+}
+
+} // namespace
+
+void log_sink::start(const options &opts)
+{
+    if (running)
+    {
+        return;
+    }
+    sink_options = opts;
+    min_level = static_cast<uint8_t>(opts.level);
+    epoch.fetch_add(1, memory_order_release);
+    running = true;
+    writer_thread = thread{run_writer};
+}
+
+void log_sink::stop()
+{
+    if (!running.exchange(false))
+    {
+        return;
+    }
+    {
+        lock_guard<mutex> lock{wake_mutex};
+        wake.notify_one();
+    }
+    writer_thread.join();
+    lock_guard<mutex> lock{producers_mutex};
+    producers.clear();
+    retired_drops = 0;
+    generation.fetch_add(1, memory_order_release);
+}
+
+bool log_sink::enabled(log_level level)
+{
+    return static_cast<uint8_t>(level) >= min_level.load(memory_order_relaxed);
+}
+
+uint64_t log_sink::dropped()
+{
+    lock_guard<mutex> lock{producers_mutex};
+    return retired_drops + count_drops(producers);
+}
+
+bool log_sink::parse_level(const string &name, log_level *level)
+{
+    for (auto l : {log_level::debug, log_level::info, log_level::warning,
+                   log_level::error})
+    {
+        if (name == level_name(l))
+        {
+            *level = l;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *log_sink::level_name(log_level level)
+{
+    switch (level)
+    {
+    case log_level::debug: return "debug";
+    case log_level::info: return "info";
+    case log_level::warning: return "warning";
+    case log_level::error: return "error";
+    }
+    return "unknown";
+}
+
+log_line::log_line(log_level level)
+    : level{level},
+      out{nullptr}
+{
+    if (!log_sink::enabled(level))
+    {
+        return;
+    }
+    line_builder &b = builder();
+    b.buf.text.clear();
+    b.out.clear();
+    b.out.flags(ios_base::dec | ios_base::skipws);
+    b.out.precision(6);
+    b.out.width(0);
+    out = &b.out;
+}
+
+log_line::~log_line()
+{
+    if (!out)
+    {
+        return;
+    }
+    string &text = builder().buf.text;
+    while (!text.empty() && text.back() == '\n')
+    {
+        text.pop_back();
+    }
+
+    if (!running.load(memory_order_acquire))
+    {
+        cout << text << endl;
+        return;
+    }
+    producer *p = local_producer();
+    uint64_t now = unix_now();
+    bool queued = p->ring.push([this, &text, now](log_record &r)
+    {
+        r.unix_ns = now;
+        r.level = level;
+        //slot keeps capacity of a written line for the next one
+        r.text.swap(text);
+    });
+    if (!queued)
+    {
+        p->dropped.fetch_add(1, memory_order_relaxed);
+    }
+    else
+    {
+        //pairs with the writer fence: either it sees this line or this
+        //thread sees it sleeping
+        atomic_thread_fence(memory_order_seq_cst);
+        if (writer_sleeping.load(memory_order_relaxed))
+        {
+            wake.notify_one();
+        }
+    }
+}
+
+ostream &log_line::stream()
+{
+    thread_local ostream discard{nullptr};
+    return out ? *out : discard;
+}
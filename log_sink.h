@@ -0,0 +1,66 @@
+#ifndef LOG_SINK_H
+#define LOG_SINK_H
+
+#include <cstdint>
+#include <string>
+#include <ostream>
+
+enum class log_level : uint8_t {debug, info, warning, error};
+
+//process wide output of events; every thread queues its lines into own
+//lock-free ring and a writer thread sends them out in big writes, so a slow
+//terminal never stalls io threads; full ring drops lines and counts them.
+//Before start and after stop lines are written to cout directly
+class log_sink
+{
+public:
+    struct options
+    {
+        log_level level = log_level::info;
+        //one JSON object per line instead of plain text
+        bool json = false;
+        //lines queued per producer thread
+        size_t queue_lines = 64 * 1024;
+    };
+
+    static void start(const options &opts);
+    //writes out everything queued and joins the writer
+    static void stop();
+
+    static bool enabled(log_level level);
+    static uint64_t dropped();
+
+    static bool parse_level(const std::string &name, log_level *level);
+    static const char *level_name(log_level level);
+};
+
+//one line of the log, queued when it goes out of scope:
+//log_line{log_level::warning} << "text " << value;
+class log_line
+{
+public:
+    explicit log_line(log_level level = log_level::info);
+    ~log_line();
+    log_line(const log_line &) = delete;
+    log_line &operator=(const log_line &) = delete;
+
+    template <typename T>
+    log_line &operator<<(const T &value)
+    {
+        if (out)
+        {
+            *out << value;
+        }
+        return *this;
+    }
+
+    //for writers to ostream, trailing new line is dropped
+    std::ostream &stream();
+
+private:
+    log_level level;
+    //null when level is filtered out
+    std::ostream *out;
+};
+
+#endif // LOG_SINK_H
@@ -3,33 +3,391 @@
 #include <iostream>
 #include <exception>
 #include <thread>
+#include <chrono>
 #include <string>
+#include <vector>
+#include <map>
+#include <sstream>
 #include <atomic>
+#include <csignal>
+
+#include <boost/asio.hpp>
+#ifdef __unix__
+#include <unistd.h>
+#endif
 
 #include "client.h"
+#include "load_generator.h"
+#include "percentiles.h"
+#include "metrics.h"
+#include "line_framer.h"
+#include "log_sink.h"
 
 using namespace std;
 
+static void print_usage()
+{
+    cerr << "Usage: test_client [--send-buffer <bytes>] "
+            "[--overflow block|drop-oldest|drop-newest] "
+            "[--framing text|binary] [--bench ping|bulk|all] "
+            "[--bench-size <bytes>] [--bench-count <messages>] "
+            "[--stagger <ms>] [--port-predict <count>] "
+            "[--retry-delay <ms>] [--attempt-timeout <ms>] "
+            "[--punch-deadline <ms>] [--heartbeat <ms>] "
+            "[--heartbeat-timeout <ms>] [--peer-cache <file>] "
+            "[--peer-cache-ttl <seconds>] [--threads <count>] "
+            "[--input line|block] "
+            "[--log-level debug|info|warning|error] [--log-format text|json] "
+            "[--log-queue <lines>] <own_name> <server_ip> <server_port> "
+            "[friend_name[,friend_name...]]" << endl;
+    cerr << "       test_client --sessions <count> [--threads <count>] "
+            "[--duration <seconds>] <name_prefix> <server_ip> <server_port>"
+         << endl;
+    cerr << "Type /stats (or send SIGUSR1) to print phase latencies, "
+            "/send [@friend] <path> to send a file (binary framing), "
+            "@friend <text> to write to one friend only" << endl;
+}
+
+//dump metrics on SIGUSR1 from a dedicated thread
+static void start_stats_signal()
+{
+#ifdef SIGUSR1
+    static boost::asio::io_service service;
+    static boost::asio::signal_set signals{service, SIGUSR1};
+    static std::function<void(boost::system::error_code, int)> wait =
+        [](boost::system::error_code ec, int)
+        {
+            if (!ec)
+            {
+                metrics::dump(log_line{}.stream());
+                signals.async_wait(wait);
+            }
+        };
+    signals.async_wait(wait);
+    //joined at exit before the service above is destroyed
+    static struct stats_thread
+    {
+        thread t;
+        ~stats_thread()
+        {
+            service.stop();
+            t.join();
+        }
+    } runner{thread{[]{ service.run(); }}};
+#endif
+}
+
+#ifdef __unix__
+//read stdin in big blocks and split lines here instead of getline per line
+template <typename F>
+static void read_input_blocks(F send_line, const atomic<bool> &in_work)
+{
+    line_framer framer;
+    string line;
+    while (in_work)
+    {
+        boost::asio::mutable_buffer buf = framer.prepare(64 * 1024);
+        ssize_t bytes = ::read(STDIN_FILENO, buf.data(), buf.size());
+        if (bytes <= 0)
+        {
+            break;
+        }
+        framer.commit(static_cast<size_t>(bytes));
+
+        string_view l;
+        while (framer.next_line(&l))
+        {
+            line.assign(l.data(), l.size());
+            send_line(&line);
+        }
+        if (framer.overflow())
+        {
+            log_line{log_level::warning} << "too long input line";
+            break;
+        }
+    }
+}
+#endif
+
+//split "--key value" options from positional arguments
+static bool parse_args(int argc, char *argv[], map<string, string> *options,
+                       vector<string> *positional)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        string arg = argv[i];
+        if (arg.compare(0, 2, "--") == 0)
+        {
+            if (i + 1 >= argc)
+            {
+                return false;
+            }
+            (*options)[arg.substr(2)] = argv[++i];
+        }
+        else
+        {
+            positional->push_back(move(arg));
+        }
+    }
+    return true;
+}
+
+static bool parse_log_options(const map<string, string> &options,
+                              log_sink::options *log_options)
+{
+    if (options.count("log-level") &&
+        !log_sink::parse_level(options.at("log-level"), &log_options->level))
+    {
+        return false;
+    }
+    if (options.count("log-format"))
+    {
+        string format = options.at("log-format");
+        if (format != "text" && format != "json")
+        {
+            return false;
+        }
+        log_options->json = format == "json";
+    }
+    if (options.count("log-queue"))
+    {
+        log_options->queue_lines = stoul(options.at("log-queue"));
+    }
+    return true;
+}
+
+static int run_load(const map<string, string> &options,
+                    const vector<string> &positional)
+{
+    if (positional.size() != 3)
+    {
+        print_usage();
+        return -1;
+    }
+
+    size_t sessions = stoul(options.at("sessions"));
+    size_t threads = options.count("threads") ?
+                stoul(options.at("threads")) :
+                max(1u, thread::hardware_concurrency());
+    long duration = options.count("duration") ?
+                stol(options.at("duration")) : 0;
+
+    load_generator generator{positional[0], positional[1],
+                             static_cast<uint16_t>(stoi(positional[2])),
+                             sessions, threads};
+
+    atomic<bool> in_work{true};
+    thread input{
+        [&in_work, duration]
+        {
+            if (duration > 0)
+            {
+                return;
+            }
+            string line;
+            while (getline(cin, line) && line != "quit")
+            {
+                if (line == "/stats")
+                {
+                    metrics::dump(log_line{}.stream());
+                }
+            }
+            in_work = false;
+        }
+    };
+    input.detach();
+
+    auto report = [&generator]
+    {
+        log_line{} << "sessions: " << generator.sessions() <<
+                ", communicating: " << generator.communicating() <<
+                ", closed: " << generator.closed();
+    };
+
+    generator.start();
+    auto finish = chrono::steady_clock::now() + chrono::seconds(duration);
+    while (in_work && (duration <= 0 || chrono::steady_clock::now() < finish))
+    {
+        this_thread::sleep_for(chrono::seconds(1));
+        report();
+    }
+    generator.stop();
+    report();
+    log_line{} << "time to communicate: " <<
+            percentiles::calculate(generator.communication_latencies())
+            .to_string("ms");
+    metrics::dump(log_line{}.stream());
+
+    return 0;
+}
+
 int main(int argc, char *argv[])
 {
-    if (argc != 4 && argc != 5)
+    map<string, string> options;
+    vector<string> positional;
+    if (!parse_args(argc, argv, &options, &positional))
+    {
+        print_usage();
+        return -1;
+    }
+
+    log_sink::options log_options;
+    if (!parse_log_options(options, &log_options))
+    {
+        print_usage();
+        return -1;
+    }
+    start_stats_signal();
+    if (options.count("sessions"))
+    {
+        log_sink::start(log_options);
+        int result = run_load(options, positional);
+        log_sink::stop();
+        return result;
+    }
+
+    if (positional.size() != 3 && positional.size() != 4)
+    {
+        print_usage();
+        return -1;
+    }
+
+    //friends are separated by commas
+    vector<string> friend_names;
+    if (positional.size() == 4)
+    {
+        stringstream list{positional[3]};
+        string friend_name;
+        while (getline(list, friend_name, ','))
+        {
+            if (!friend_name.empty())
+            {
+                friend_names.push_back(friend_name);
+            }
+        }
+    }
+    client::ptr cl = client::create(positional[0],
+            positional[1], static_cast<uint16_t>(stoi(positional[2])),
+            friend_names);
+
+    send_buffer::options send_options;
+    if (options.count("send-buffer"))
     {
-        cerr << "Usage: test_client <own_name> <server_ip> <server_port> "
-                "[friend_name]" << endl;
+        send_options.max_bytes = stoul(options.at("send-buffer"));
+        send_options.high_watermark = send_options.max_bytes / 4 * 3;
+        send_options.low_watermark = send_options.max_bytes / 4;
+    }
+    if (options.count("overflow") &&
+        !send_buffer::parse_policy(options.at("overflow"),
+                                   &send_options.policy))
+    {
+        print_usage();
         return -1;
     }
+    cl->set_send_options(send_options);
+
+    bool block_input = false;
+    if (options.count("input"))
+    {
+        string input = options.at("input");
+        if (input != "line" && input != "block")
+        {
+            print_usage();
+            return -1;
+        }
+        block_input = input == "block";
+    }
+
+    if (options.count("framing"))
+    {
+        string framing = options.at("framing");
+        if (framing != "text" && framing != "binary")
+        {
+            print_usage();
+            return -1;
+        }
+        cl->set_binary_framing(framing == "binary");
+    }
+
+    link_bench::options bench_options;
+    if (options.count("bench") &&
+        !link_bench::parse_mode(options.at("bench"), &bench_options.test))
+    {
+        print_usage();
+        return -1;
+    }
+    if (options.count("bench-size"))
+    {
+        bench_options.size = stoul(options.at("bench-size"));
+    }
+    if (options.count("bench-count"))
+    {
+        bench_options.count = stoul(options.at("bench-count"));
+    }
+    cl->set_link_bench(bench_options);
+
+    connection_race::options race_options;
+    if (options.count("stagger"))
+    {
+        race_options.stagger =
+                boost::posix_time::milliseconds(stol(options.at("stagger")));
+    }
+    if (options.count("retry-delay"))
+    {
+        race_options.retry_delay = boost::posix_time::milliseconds(
+                    stol(options.at("retry-delay")));
+    }
+    if (options.count("attempt-timeout"))
+    {
+        race_options.attempt_timeout = boost::posix_time::milliseconds(
+                    stol(options.at("attempt-timeout")));
+    }
+    if (options.count("punch-deadline"))
+    {
+        race_options.deadline = boost::posix_time::milliseconds(
+                    stol(options.at("punch-deadline")));
+    }
+    cl->set_race_options(race_options, options.count("port-predict") ?
+                             stoul(options.at("port-predict")) : 0);
 
-    client::ptr cl = client::create(argv[1],
-            argv[2], static_cast<uint16_t>(atoi(argv[3])),
-            argc == 5 ? argv[4] : "");
+    //dead friend is detected after heartbeat timeout and punched again;
+    //off by default, old friends know only plain activate
+    client::heartbeat_options heartbeat;
+    heartbeat.interval = boost::posix_time::milliseconds(
+                options.count("heartbeat") ? stol(options.at("heartbeat")) : 0);
+    heartbeat.timeout = options.count("heartbeat-timeout") ?
+                boost::posix_time::milliseconds(
+                    stol(options.at("heartbeat-timeout"))) :
+                heartbeat.interval * 3;
+    cl->set_heartbeat(heartbeat);
 
+    //endpoints of punched friends survive restarts
+    if (options.count("peer-cache"))
+    {
+        cl->set_peer_cache(options.at("peer-cache"),
+                boost::posix_time::seconds(options.count("peer-cache-ttl") ?
+                        stol(options.at("peer-cache-ttl")) : 600));
+    }
+
+    //stop reading input while friend can't keep up
+    atomic<bool> paused{false};
+    cl->set_watermark_handlers([&paused]{ paused = true; },
+                               [&paused]{ paused = false; });
+
+    //handlers of the session are serialized by its strand, more threads
+    //only spread syscalls and file transfers over cores
+    size_t threads = options.count("threads") ? stoul(options.at("threads")) :
+                                                1;
+
+    //console output leaves io threads through the writer thread
+    log_sink::start(log_options);
     atomic<bool> in_work{true};
     thread t{
-        [&cl, &in_work]
+        [&cl, &in_work, threads]
         {
             try
             {
-                cl->run();
+                cl->run(threads);
             }
             catch (exception &e)
             {
@@ -39,18 +397,67 @@ int main(int argc, char *argv[])
             {
                 cerr << "Undefined exception" << endl;
             }
-            cout << "Press <RETURN> to close this window..." << endl;
+            log_line{} << "Press <RETURN> to close this window...";
             in_work = false;
         }
     };
     t.detach();
 
-    while (in_work)
+    //lines go to the io thread through the lock-free input ring
+    auto send_line = [&cl, &paused, &in_work](string *line)
+    {
+        if (*line == "/stats")
+        {
+            metrics::dump(log_line{}.stream());
+            return;
+        }
+        if (line->compare(0, 6, "/send ") == 0)
+        {
+            string path = line->substr(6);
+            string to;
+            if (!path.empty() && path[0] == '@')
+            {
+                size_t space = path.find(' ');
+                to = path.substr(1, space - 1);
+                path = space == string::npos ? "" : path.substr(space + 1);
+            }
+            cl->send_file(path, to);
+            return;
+        }
+        while (paused && in_work)
+        {
+            this_thread::sleep_for(chrono::milliseconds(1));
+        }
+        if (line->empty())
+        {
+            return;
+        }
+        while (!cl->write_input(line) && in_work)
+        {
+            this_thread::yield();
+        }
+    };
+
+#ifdef __unix__
+    if (block_input)
+    {
+        read_input_blocks(send_line, in_work);
+    }
+    else
+#endif
     {
         string message;
-        getline(cin, message);
-        cl->write(message);
+        while (in_work && getline(cin, message))
+        {
+            send_line(&message);
+        }
+    }
+    //input is closed, keep session alive until it finishes
+    while (in_work)
+    {
+        this_thread::sleep_for(chrono::milliseconds(100));
     }
+    log_sink::stop();
 
     return 0;
 }
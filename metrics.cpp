@@ -0,0 +1,143 @@
+#include "metrics.h"
+
+#include <cstdint>
+#include <ostream>
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+
+using namespace std;
+
+namespace
+{
+
+//log-linear buckets: 4 per power of two, so bucket bounds are within 19%
+class latency_histogram
+{
+public:
+    static constexpr int SUB_BUCKETS = 4;
+    static constexpr int BUCKETS = 64 * SUB_BUCKETS;
+
+    void record(uint64_t ns)
+    {
+        buckets[index(ns)].fetch_add(1, memory_order_relaxed);
+        total.fetch_add(1, memory_order_relaxed);
+        uint64_t prev = maximum.load(memory_order_relaxed);
+        while (prev < ns &&
+               !maximum.compare_exchange_weak(prev, ns, memory_order_relaxed))
+        {
+        }
+    }
+
+    uint64_t count() const { return total.load(memory_order_relaxed); }
+    uint64_t max() const { return maximum.load(memory_order_relaxed); }
+
+    //upper bound of the bucket holding the given fraction of samples
+    uint64_t percentile(double fraction) const
+    {
+        uint64_t n = count();
+        uint64_t target = static_cast<uint64_t>(fraction * n + 0.5);
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; ++i)
+        {
+            seen += buckets[i].load(memory_order_relaxed);
+            if (seen >= target && seen != 0)
+            {
+                return std::min(upper_bound(i), max());
+            }
+        }
+        return max();
+    }
+
+private:
+    atomic<uint64_t> buckets[BUCKETS] = {};
+    atomic<uint64_t> total{0};
+    atomic<uint64_t> maximum{0};
+
+    static int index(uint64_t ns)
+    {
+        if (ns < SUB_BUCKETS)
+        {
+            return static_cast<int>(ns);
+        }
+        int power = 63 - __builtin_clzll(ns);
+        int sub = static_cast<int>((ns >> (power - 2)) & (SUB_BUCKETS - 1));
+        return (power - 1) * SUB_BUCKETS + sub;
+    }
+
+    static uint64_t upper_bound(int i)
+    {
+        if (i < SUB_BUCKETS)
+        {
+            return i;
+        }
+        int power = i / SUB_BUCKETS + 1;
+        uint64_t sub = i % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << (power - 2)) - 1;
+    }
+};
+
+latency_histogram histograms[static_cast<int>(metric::count)];
+
+const char *names[] = {
+    "server_connect",
+    "connect_answer",
+    "get_list_answer",
+    "watch_answer",
+    "online_wait",
+    "get_info_answer",
+    "private_connect",
+    "public_connect",
+    "punch_attempt",
+    "friend_accept",
+    "activation",
+    "wait_friend_state",
+    "connect_friend_state",
+    "time_to_communicate",
+    "link_recovery",
+};
+static_assert(sizeof(names) / sizeof(names[0]) ==
+              static_cast<size_t>(metric::count), "metric without name");
+
+}
+
+uint64_t metrics::now()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void metrics::record(metric m, uint64_t ns)
+{
+    histograms[static_cast<int>(m)].record(ns);
+}
+
+void metrics::dump(ostream &out)
+{
+    if (!enabled())
+    {
+        out << "metrics are disabled at compile time" << endl;
+        return;
+    }
+
+    auto ms = [](uint64_t ns){ return ns / 1e6; };
+    out << left << setw(22) << "phase" << right << setw(10) << "count" <<
+           setw(12) << "p50 ms" << setw(12) << "p90 ms" << setw(12) <<
+           "p99 ms" << setw(12) << "max ms" << "\n" << fixed <<
+           setprecision(3);
+    for (int i = 0; i < static_cast<int>(metric::count); ++i)
+    {
+        const latency_histogram &h = histograms[i];
+        if (h.count() == 0)
+        {
+            continue;
+        }
+        out << left << setw(22) << names[i] << right << setw(10) <<
+               h.count() << setw(12) << ms(h.percentile(0.5)) << setw(12) <<
+               ms(h.percentile(0.9)) << setw(12) << ms(h.percentile(0.99)) <<
+               setw(12) << ms(h.max()) << "\n";
+    }
+    out << flush;
+}
@@ -0,0 +1,69 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <cstdint>
+#include <ostream>
+
+//phases of the session and request/answer pairs which are timed
+enum class metric
+{
+    server_connect,
+    connect_answer,
+    get_list_answer,
+    watch_answer,
+    online_wait,
+    get_info_answer,
+    private_connect,
+    public_connect,
+    punch_attempt,
+    friend_accept,
+    activation,
+    wait_friend_state,
+    connect_friend_state,
+    time_to_communicate,
+    //from a lost friend link to communication again
+    link_recovery,
+    count
+};
+
+//process wide latency histograms; compiled out without CLIENT_METRICS
+class metrics
+{
+public:
+    static constexpr bool enabled()
+    {
+#ifdef CLIENT_METRICS
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    static uint64_t now();
+    static void record(metric m, uint64_t ns);
+    static void dump(std::ostream &out);
+};
+
+//start of a timed interval
+class metric_stamp
+{
+public:
+#ifdef CLIENT_METRICS
+    void start() { ns = metrics::now(); }
+    void record(metric m) const
+    {
+        if (ns != 0)
+        {
+            metrics::record(m, metrics::now() - ns);
+        }
+    }
+
+private:
+    uint64_t ns = 0;
+#else
+    void start() {}
+    void record(metric) const {}
+#endif
+};
+
+#endif // METRICS_H
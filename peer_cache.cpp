@@ -0,0 +1,313 @@
+#include "peer_cache.h"
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+
+#ifdef __unix__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+using namespace boost::asio;
+using ip::tcp;
+
+namespace
+{
+
+const char MAGIC[8] = {'H', 'P', 'C', 'A', 'C', 'H', 'E', '1'};
+const uint32_t CAPACITY = 256;
+//longer names are not cached
+const size_t NAME_SIZE = 32;
+const size_t PATH_SIZE = 12;
+
+struct disk_endpoint
+{
+    uint8_t address[16];
+    uint16_t port;
+    uint8_t v6;
+    uint8_t used;
+};
+
+struct disk_entry
+{
+    char own[NAME_SIZE];
+    char friend_name[NAME_SIZE];
+    disk_endpoint private_endpoint;
+    disk_endpoint public_endpoint;
+    disk_endpoint winner;
+    char path[PATH_SIZE];
+    //zero marks a free record
+    uint64_t unix_time;
+};
+
+struct disk_header
+{
+    char magic[8];
+    uint32_t capacity;
+    uint32_t entry_size;
+};
+
+const size_t FILE_SIZE = sizeof(disk_header) + CAPACITY * sizeof(disk_entry);
+
+disk_entry *entries(char *map)
+{
+    return reinterpret_cast<disk_entry *>(map + sizeof(disk_header));
+}
+
+bool fits(string_view name)
+{
+    return !name.empty() && name.size() < NAME_SIZE;
+}
+
+bool name_equal(const char (&stored)[NAME_SIZE], string_view name)
+{
+    return strncmp(stored, name.data(), name.size()) == 0 &&
+           stored[name.size()] == '\0';
+}
+
+void copy_name(char (&stored)[NAME_SIZE], string_view name)
+{
+    memset(stored, 0, NAME_SIZE);
+    memcpy(stored, name.data(), name.size());
+}
+
+disk_endpoint to_disk(const tcp::endpoint &endpoint)
+{
+    disk_endpoint d{};
+    ip::address address = endpoint.address();
+    if (address.is_v6())
+    {
+        auto bytes = address.to_v6().to_bytes();
+        memcpy(d.address, bytes.data(), bytes.size());
+        d.v6 = 1;
+    }
+    else
+    {
+        auto bytes = address.to_v4().to_bytes();
+        memcpy(d.address, bytes.data(), bytes.size());
+    }
+    d.port = endpoint.port();
+    d.used = 1;
+    return d;
+}
+
+tcp::endpoint from_disk(const disk_endpoint &d)
+{
+    if (!d.used)
+    {
+        return {};
+    }
+    if (d.v6)
+    {
+        ip::address_v6::bytes_type bytes;
+        memcpy(bytes.data(), d.address, bytes.size());
+        return {ip::address_v6{bytes}, d.port};
+    }
+    ip::address_v4::bytes_type bytes;
+    memcpy(bytes.data(), d.address, bytes.size());
+    return {ip::address_v4{bytes}, d.port};
+}
+
+#ifdef __unix__
+//records are small, a lock of the whole file keeps other clients out
+class file_lock
+{
+public:
+    file_lock(int fd, int operation) : fd{fd} { flock(fd, operation); }
+    ~file_lock() { flock(fd, LOCK_UN); }
+
+private:
+    int fd;
+};
+#endif
+
+} // namespace
+
+peer_cache::~peer_cache()
+{
+    close();
+}
+
+bool peer_cache::open(const string &path, string *error)
+{
+#ifdef __unix__
+    close();
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0)
+    {
+        *error = strerror(errno);
+        return false;
+    }
+
+    file_lock lock{fd, LOCK_EX};
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        *error = strerror(errno);
+        close();
+        return false;
+    }
+    bool fresh = static_cast<size_t>(st.st_size) != FILE_SIZE;
+    if (fresh && ftruncate(fd, 0) != 0)
+    {
+        *error = strerror(errno);
+        close();
+        return false;
+    }
+    if (ftruncate(fd, static_cast<off_t>(FILE_SIZE)) != 0)
+    {
+        *error = strerror(errno);
+        close();
+        return false;
+    }
+    void *p = mmap(nullptr, FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   fd, 0);
+    if (p == MAP_FAILED)
+    {
+        *error = strerror(errno);
+        close();
+        return false;
+    }
+    map = static_cast<char *>(p);
+
+    //file of another version starts empty
+    disk_header *header = reinterpret_cast<disk_header *>(map);
+    if (fresh || memcmp(header->magic, MAGIC, sizeof(MAGIC)) != 0 ||
+        header->capacity != CAPACITY ||
+        header->entry_size != sizeof(disk_entry))
+    {
+        memset(map, 0, FILE_SIZE);
+        memcpy(header->magic, MAGIC, sizeof(MAGIC));
+        header->capacity = CAPACITY;
+        header->entry_size = sizeof(disk_entry);
+    }
+    return true;
+#else
+    (void)path;
+    *error = "memory mapped files are not supported on this platform";
+    return false;
+#endif
+}
+
+void peer_cache::close()
+{
+#ifdef __unix__
+    if (map)
+    {
+        munmap(map, FILE_SIZE);
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+    }
+#endif
+    map = nullptr;
+    fd = -1;
+}
+
+bool peer_cache::find(string_view own, string_view friend_name, uint64_t ttl,
+                      entry *out) const
+{
+    if (!map || !fits(own) || !fits(friend_name))
+    {
+        return false;
+    }
+#ifdef __unix__
+    file_lock lock{fd, LOCK_SH};
+#endif
+    uint64_t now = unix_now();
+    const disk_entry *list = entries(map);
+    for (uint32_t i = 0; i < CAPACITY; ++i)
+    {
+        const disk_entry &d = list[i];
+        if (d.unix_time == 0 || !name_equal(d.own, own) ||
+            !name_equal(d.friend_name, friend_name))
+        {
+            continue;
+        }
+        if (d.unix_time + ttl < now)
+        {
+            return false;
+        }
+        out->private_endpoint = from_disk(d.private_endpoint);
+        out->public_endpoint = from_disk(d.public_endpoint);
+        out->winner = from_disk(d.winner);
+        out->path.assign(d.path, strnlen(d.path, PATH_SIZE));
+        out->unix_time = d.unix_time;
+        return true;
+    }
+    return false;
+}
+
+void peer_cache::store(string_view own, string_view friend_name,
+                       const entry &e)
+{
+    if (!map || !fits(own) || !fits(friend_name))
+    {
+        return;
+    }
+#ifdef __unix__
+    file_lock lock{fd, LOCK_EX};
+#endif
+    disk_entry *list = entries(map);
+    disk_entry *slot = nullptr;
+    for (uint32_t i = 0; i < CAPACITY; ++i)
+    {
+        disk_entry &d = list[i];
+        if (d.unix_time != 0 && name_equal(d.own, own) &&
+            name_equal(d.friend_name, friend_name))
+        {
+            slot = &d;
+            break;
+        }
+        if (!slot || d.unix_time < slot->unix_time)
+        {
+            slot = &d;
+        }
+    }
+
+    disk_entry d{};
+    copy_name(d.own, own);
+    copy_name(d.friend_name, friend_name);
+    d.private_endpoint = to_disk(e.private_endpoint);
+    d.public_endpoint = to_disk(e.public_endpoint);
+    d.winner = to_disk(e.winner);
+    memcpy(d.path, e.path.data(), min(e.path.size(), PATH_SIZE - 1));
+    d.unix_time = e.unix_time ? e.unix_time : unix_now();
+    *slot = d;
+}
+
+void peer_cache::erase(string_view own, string_view friend_name)
+{
+    if (!map || !fits(own) || !fits(friend_name))
+    {
+        return;
+    }
+#ifdef __unix__
+    file_lock lock{fd, LOCK_EX};
+#endif
+    disk_entry *list = entries(map);
+    for (uint32_t i = 0; i < CAPACITY; ++i)
+    {
+        disk_entry &d = list[i];
+        if (d.unix_time != 0 && name_equal(d.own, own) &&
+            name_equal(d.friend_name, friend_name))
+        {
+            d.unix_time = 0;
+        }
+    }
+}
+
+uint64_t peer_cache::unix_now()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
@@ -0,0 +1,52 @@
+#ifndef PEER_CACHE_H
+#define PEER_CACHE_H
+
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <boost/asio.hpp>
+
+//endpoints of friends which were punched successfully, kept in a small
+//memory mapped file of fixed records, so a restarted client can punch
+//before the server answers; records are keyed by own and friend name,
+//several clients may share the file
+class peer_cache
+{
+public:
+    struct entry
+    {
+        boost::asio::ip::tcp::endpoint private_endpoint;
+        boost::asio::ip::tcp::endpoint public_endpoint;
+        //endpoint and kind ("private", "public"...) of the last winner
+        boost::asio::ip::tcp::endpoint winner;
+        std::string path;
+        //seconds since the epoch when the punch succeeded
+        uint64_t unix_time = 0;
+    };
+
+    peer_cache() = default;
+    peer_cache(const peer_cache &) = delete;
+    peer_cache &operator=(const peer_cache &) = delete;
+    ~peer_cache();
+
+    //creates the file when it doesn't exist or has another layout
+    bool open(const std::string &path, std::string *error);
+    void close();
+    bool is_open() const { return map != nullptr; }
+
+    //false when there is no record or it is older than ttl seconds
+    bool find(std::string_view own, std::string_view friend_name,
+              uint64_t ttl, entry *out) const;
+    //replaces the record of the pair, or the oldest one when full
+    void store(std::string_view own, std::string_view friend_name,
+               const entry &e);
+    void erase(std::string_view own, std::string_view friend_name);
+
+    static uint64_t unix_now();
+
+private:
+    int fd = -1;
+    char *map = nullptr;
+};
+
+#endif // PEER_CACHE_H
@@ -0,0 +1,43 @@
+#include "percentiles.h"
+
+#include <vector>
+#include <string>
+
+#include <cmath>
+#include <sstream>
+#include <algorithm>
+
+using namespace std;
+
+static double nearest_rank(const vector<double> &sorted, double fraction)
+{
+    size_t index = static_cast<size_t>(ceil(fraction * sorted.size()));
+    return sorted[min(sorted.size(), max<size_t>(index, 1)) - 1];
+}
+
+percentiles percentiles::calculate(vector<double> values)
+{
+    percentiles res;
+    res.count = values.size();
+    if (values.empty())
+    {
+        return res;
+    }
+
+    sort(values.begin(), values.end());
+    res.p50 = nearest_rank(values, 0.5);
+    res.p99 = nearest_rank(values, 0.99);
+    res.p999 = nearest_rank(values, 0.999);
+    res.max = values.back();
+    return res;
+}
+
+string percentiles::to_string(const string &unit) const
+{
+    ostringstream out;
+    out.precision(3);
+    out << fixed << "p50 " << p50 << " " << unit << ", p99 " << p99 << " " <<
+           unit << ", p999 " << p999 << " " << unit << ", max " << max <<
+           " " << unit << " (" << count << " samples)";
+    return out.str();
+}
@@ -0,0 +1,20 @@
+#ifndef PERCENTILES_H
+#define PERCENTILES_H
+
+#include <vector>
+#include <string>
+
+//distribution of measured values (in any unit) by nearest rank
+struct percentiles
+{
+    size_t count = 0;
+    double p50 = 0;
+    double p99 = 0;
+    double p999 = 0;
+    double max = 0;
+
+    static percentiles calculate(std::vector<double> values);
+    std::string to_string(const std::string &unit) const;
+};
+
+#endif // PERCENTILES_H
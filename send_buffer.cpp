@@ -0,0 +1,273 @@
+#include "send_buffer.h"
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#include <utility>
+#include <algorithm>
+
+using namespace std;
+
+//big strings are freed not to hold memory
+static const size_t MAX_SPARE_CAPACITY = 64 * 1024;
+
+send_buffer::send_buffer()
+{
+}
+
+void send_buffer::configure(const options &opts)
+{
+    lock_guard<mutex> lock{buffer_mutex};
+    this->opts = opts;
+}
+
+void send_buffer::set_watermark_handlers(function<void()> high,
+                                         function<void()> low)
+{
+    lock_guard<mutex> lock{buffer_mutex};
+    high_handler = move(high);
+    low_handler = move(low);
+}
+
+send_buffer::push_result send_buffer::push(string message)
+{
+    push_result res;
+    function<void()> handler;
+    {
+        unique_lock<mutex> lock{buffer_mutex};
+        //message which is bigger than the whole budget still passes alone
+        auto fits = [this, &message]
+            {
+                return used() == 0 ||
+                       used() + message.size() <= opts.max_bytes;
+            };
+
+        if (!closed && !fits())
+        {
+            switch (opts.policy)
+            {
+            case overflow_policy::block:
+                space_available.wait(lock,
+                        [this, &fits]{ return closed || fits(); });
+                break;
+            case overflow_policy::drop_oldest:
+            {
+                size_t dropped = 0;
+                while (dropped < queue.size() && !fits())
+                {
+                    queued_bytes -= queue[dropped].size();
+                    res.lost.push_back(move(queue[dropped++]));
+                }
+                queue.erase(queue.begin(), queue.begin() + dropped);
+                break;
+            }
+            case overflow_policy::drop_newest:
+                res.lost.push_back(move(message));
+                return res;
+            }
+        }
+        if (closed)
+        {
+            res.lost.push_back(move(message));
+            return res;
+        }
+
+        queued_bytes += message.size();
+        queue.push_back(move(message));
+        res.wake_writer = writer_idle;
+        writer_idle = false;
+        handler = check_high();
+    }
+
+    if (handler)
+    {
+        handler();
+    }
+    return res;
+}
+
+send_buffer::push_result send_buffer::push_control(string message)
+{
+    push_result res;
+    function<void()> handler;
+    {
+        lock_guard<mutex> lock{buffer_mutex};
+        if (closed)
+        {
+            res.lost.push_back(move(message));
+            return res;
+        }
+
+        //counted in the budget, so messages make room for it
+        queued_bytes += message.size();
+        control.push_back(move(message));
+        res.wake_writer = writer_idle;
+        writer_idle = false;
+        handler = check_high();
+    }
+
+    if (handler)
+    {
+        handler();
+    }
+    return res;
+}
+
+function<void()> send_buffer::check_high()
+{
+    if (above_high || used() < opts.high_watermark)
+    {
+        return nullptr;
+    }
+    above_high = true;
+    return high_handler;
+}
+
+bool send_buffer::would_block(size_t bytes) const
+{
+    lock_guard<mutex> lock{buffer_mutex};
+    return opts.policy == overflow_policy::block && !closed &&
+           used() != 0 && used() + bytes > opts.max_bytes;
+}
+
+string send_buffer::acquire()
+{
+    lock_guard<mutex> lock{buffer_mutex};
+    if (spare.empty())
+    {
+        return string{};
+    }
+    string res = move(spare.back());
+    spare.pop_back();
+    spare_bytes -= res.capacity();
+    return res;
+}
+
+bool send_buffer::take(vector<string> *batch)
+{
+    lock_guard<mutex> lock{buffer_mutex};
+    if (queue.empty() && control.empty())
+    {
+        writer_idle = true;
+        return false;
+    }
+
+    //control frames are small and time critical, they go first
+    if (!control.empty())
+    {
+        move(control.begin(), control.end(), back_inserter(*batch));
+        control.clear();
+    }
+    if (batch->empty())
+    {
+        batch->swap(queue);
+    }
+    else
+    {
+        move(queue.begin(), queue.end(), back_inserter(*batch));
+        queue.clear();
+    }
+    sending_bytes += queued_bytes;
+    queued_bytes = 0;
+    return true;
+}
+
+void send_buffer::release(size_t bytes)
+{
+    function<void()> handler;
+    {
+        lock_guard<mutex> lock{buffer_mutex};
+        sending_bytes -= min(bytes, sending_bytes);
+        if (above_high && used() <= opts.low_watermark)
+        {
+            above_high = false;
+            handler = low_handler;
+        }
+    }
+    space_available.notify_all();
+
+    if (handler)
+    {
+        handler();
+    }
+}
+
+void send_buffer::recycle(vector<string> *batch)
+{
+    {
+        lock_guard<mutex> lock{buffer_mutex};
+        //as many as the queue may hold (capacity of a string grows up to
+        //twice its size), it is refilled from them
+        for (string &mes : *batch)
+        {
+            if (spare_bytes + mes.capacity() > 2 * opts.max_bytes)
+            {
+                break;
+            }
+            if (mes.capacity() <= MAX_SPARE_CAPACITY)
+            {
+                mes.clear();
+                spare_bytes += mes.capacity();
+                spare.push_back(move(mes));
+            }
+        }
+    }
+    batch->clear();
+}
+
+void send_buffer::close()
+{
+    function<void()> handler;
+    {
+        lock_guard<mutex> lock{buffer_mutex};
+        closed = true;
+        //nothing is sent anymore, so it does not hold producers back
+        if (above_high)
+        {
+            above_high = false;
+            handler = low_handler;
+        }
+    }
+    space_available.notify_all();
+
+    if (handler)
+    {
+        handler();
+    }
+}
+
+size_t send_buffer::bytes() const
+{
+    lock_guard<mutex> lock{buffer_mutex};
+    return used();
+}
+
+size_t send_buffer::max_bytes() const
+{
+    lock_guard<mutex> lock{buffer_mutex};
+    return opts.max_bytes;
+}
+
+bool send_buffer::parse_policy(const string &name, overflow_policy *policy)
+{
+    if (name == "block")
+    {
+        *policy = overflow_policy::block;
+    }
+    else if (name == "drop-oldest")
+    {
+        *policy = overflow_policy::drop_oldest;
+    }
+    else if (name == "drop-newest")
+    {
+        *policy = overflow_policy::drop_newest;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
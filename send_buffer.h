@@ -0,0 +1,86 @@
+#ifndef SEND_BUFFER_H
+#define SEND_BUFFER_H
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+//byte bounded queue of outgoing messages; producers push from any thread,
+//io thread takes everything queued as one batch and releases it when sent;
+//sent strings are kept for the next messages, so no steady state allocation
+class send_buffer
+{
+public:
+    enum class overflow_policy {block, drop_oldest, drop_newest};
+    struct options
+    {
+        size_t max_bytes = 1024 * 1024;
+        //producers are asked to slow down above high watermark and
+        //resume below low one
+        size_t high_watermark = 768 * 1024;
+        size_t low_watermark = 256 * 1024;
+        overflow_policy policy = overflow_policy::drop_oldest;
+    };
+
+    struct push_result
+    {
+        std::vector<std::string> lost;
+        //writer was idle and must be started by the caller
+        bool wake_writer = false;
+    };
+
+    send_buffer();
+
+    void configure(const options &opts);
+    //high is called on producer thread, low on the thread which releases
+    void set_watermark_handlers(std::function<void()> high,
+                                std::function<void()> low);
+
+    //empty string, which keeps capacity of a sent one when there is any
+    std::string acquire();
+    push_result push(std::string message);
+    //frame of the link protocol (pong, heartbeat, file and bulk control):
+    //never waits nor is dropped for the budget, is lost only when closed,
+    //and goes out before queued messages
+    push_result push_control(std::string message);
+    //push of message with this size would wait for space (block policy)
+    bool would_block(size_t bytes) const;
+    //move queued messages to the batch, false (and writer becomes idle)
+    //when there is nothing to send
+    bool take(std::vector<std::string> *batch);
+    void release(size_t bytes);
+    //give sent messages back for acquire, batch is cleared
+    void recycle(std::vector<std::string> *batch);
+    //wake blocked producers, next messages are dropped; buffer above high
+    //watermark reports low one
+    void close();
+
+    size_t bytes() const;
+    size_t max_bytes() const;
+    static bool parse_policy(const std::string &name, overflow_policy *policy);
+
+private:
+    mutable std::mutex buffer_mutex;
+    std::condition_variable space_available;
+    options opts;
+    //swapped with the batch on take, so both keep their capacity
+    std::vector<std::string> queue;
+    std::vector<std::string> control;
+    std::vector<std::string> spare;
+    size_t spare_bytes = 0;
+    size_t queued_bytes = 0;
+    size_t sending_bytes = 0;
+    bool writer_idle = true;
+    bool above_high = false;
+    bool closed = false;
+    std::function<void()> high_handler;
+    std::function<void()> low_handler;
+
+    size_t used() const { return queued_bytes + sending_bytes; }
+    //under the lock, handler to call when this push crossed high watermark
+    std::function<void()> check_high();
+};
+
+#endif // SEND_BUFFER_H
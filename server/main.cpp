@@ -0,0 +1,41 @@
+#include <cstdlib>
+#include <cstdint>
+#include <iostream>
+#include <exception>
+#include <string>
+
+#include <boost/asio.hpp>
+
+#include "rendezvous_server.h"
+
+using namespace std;
+using namespace boost::asio;
+using boost::asio::ip::tcp;
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2 && argc != 3)
+    {
+        cerr << "Usage: test_server <port> [address]" << endl;
+        return -1;
+    }
+
+    try
+    {
+        io_service service;
+        tcp::endpoint endpoint{
+                ip::make_address(argc == 3 ? argv[2] : "0.0.0.0"),
+                static_cast<uint16_t>(atoi(argv[1]))};
+        rendezvous_server server{service, endpoint};
+        server.start();
+        cout << "listening on " << server.local_endpoint() << endl;
+        service.run();
+    }
+    catch (exception &e)
+    {
+        cerr << "Exception: " << e.what() << endl;
+        return -1;
+    }
+
+    return 0;
+}
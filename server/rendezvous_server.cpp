@@ -0,0 +1,396 @@
+#include "rendezvous_server.h"
+#include "token_cursor.h"
+#include "command_table.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <map>
+#include <unordered_map>
+#include <boost/asio.hpp>
+
+#include <iostream>
+#include <utility>
+
+using namespace std;
+using namespace boost::asio;
+using boost::asio::ip::tcp;
+using boost_error = boost::system::error_code;
+
+class rendezvous_server::session :
+        public enable_shared_from_this<rendezvous_server::session>
+{
+public:
+    session(rendezvous_server &server, tcp::socket socket) :
+        server(server),
+        socket{move(socket)}
+    {
+    }
+
+    void start()
+    {
+        boost_error ec;
+        public_endpoint = socket.remote_endpoint(ec);
+        do_read();
+    }
+
+    //answer to the request being handled, tagged with its id
+    void reply(string message)
+    {
+        if (!request_id.empty())
+        {
+            message.insert(0, string{request_id} + " ");
+        }
+        send(move(message));
+    }
+
+    void send(string message)
+    {
+        bool write_in_progress = !output.empty();
+        output.push_back(move(message));
+        if (!write_in_progress)
+        {
+            do_write();
+        }
+    }
+
+    void close()
+    {
+        boost_error ec;
+        socket.close(ec);
+    }
+
+    const string &peer_name() const { return name; }
+    string info() const
+    {
+        return private_endpoint.address().to_string() + " " +
+               std::to_string(private_endpoint.port()) + " " +
+               public_endpoint.address().to_string() + " " +
+               std::to_string(public_endpoint.port()) + extra_addresses;
+    }
+
+private:
+    rendezvous_server &server;
+    tcp::socket socket;
+    line_framer framer;
+    deque<string> output;
+    string name;
+    tcp::endpoint private_endpoint;
+    tcp::endpoint public_endpoint;
+    //other private addresses of multi-homed peer, " a1 a2..."
+    string extra_addresses;
+    //"#<id>" of the request being handled, empty when untagged
+    string_view request_id;
+
+    void do_read()
+    {
+        string_view line;
+        while (framer.next_line(&line))
+        {
+            handle(line);
+        }
+        if (framer.overflow())
+        {
+            finish();
+            return;
+        }
+
+        socket.async_read_some(framer.prepare(),
+            [self = shared_from_this()](boost_error ec, size_t bytes)
+            {
+                if (!ec)
+                {
+                    self->framer.commit(bytes);
+                    self->do_read();
+                }
+                else
+                {
+                    self->finish();
+                }
+            }
+        );
+    }
+
+    void do_write()
+    {
+        async_write(socket, buffer(output.front()),
+            [self = shared_from_this()](boost_error ec, size_t)
+            {
+                if (ec)
+                {
+                    self->finish();
+                    return;
+                }
+                self->output.pop_front();
+                if (!self->output.empty())
+                {
+                    self->do_write();
+                }
+            }
+        );
+    }
+
+    void handle(string_view line)
+    {
+        token_cursor tokens{line};
+        string_view title = tokens.next();
+        request_id = {};
+        if (!title.empty() && title[0] == '#')
+        {
+            request_id = title;
+            title = tokens.next();
+        }
+        switch (to_verb(title))
+        {
+        case verb::connect:
+            handle_connect(&tokens);
+            break;
+        case verb::get_list:
+            reply(server.list_answer(parse_filter(&tokens)));
+            break;
+        case verb::get_info:
+            reply(server.info_answer(tokens.next()));
+            break;
+        case verb::features:
+            reply(features_answer(&tokens));
+            break;
+        case verb::watch:
+        {
+            string_view peer = tokens.next();
+            reply("watching " + string{peer} + "\r\n");
+            server.add_watcher(shared_from_this(), string{peer});
+            break;
+        }
+        default:
+            reply("error unknown_command\r\n");
+            break;
+        }
+        request_id = {};
+    }
+
+    static list_filter parse_filter(token_cursor *tokens)
+    {
+        list_filter filter;
+        string_view token;
+        while (!(token = tokens->next()).empty())
+        {
+            if (token.compare(0, 5, "name=") == 0)
+            {
+                filter.names.push_back(token.substr(5));
+            }
+            else if (token.compare(0, 7, "prefix=") == 0)
+            {
+                filter.prefix = token.substr(7);
+            }
+            else if (token.compare(0, 6, "after=") == 0)
+            {
+                filter.after = token.substr(6);
+            }
+            else if (token.compare(0, 6, "limit=") == 0)
+            {
+                token_cursor::to_number(token.substr(6), &filter.limit);
+            }
+        }
+        return filter;
+    }
+
+    //extensions which the peer asks for and this server knows: request
+    //ids in answers, list filters and more private addresses in connect
+    static string features_answer(token_cursor *tokens)
+    {
+        string answer = "features";
+        string_view token;
+        while (!(token = tokens->next()).empty())
+        {
+            if (token == "ids" || token == "list_filters" ||
+                token == "addresses")
+            {
+                answer += " " + string{token};
+            }
+        }
+        return answer + "\r\n";
+    }
+
+    void handle_connect(token_cursor *tokens)
+    {
+        string_view peer = tokens->next();
+        ip::address address;
+        boost_error ec;
+        if (!peer.empty())
+        {
+            address = ip::make_address(tokens->next(), ec);
+        }
+        uint16_t port;
+        if (peer.empty() || ec ||
+            !token_cursor::to_port(tokens->next(), &port))
+        {
+            reply("error invalid_connect\r\n");
+            return;
+        }
+        //peer may list more private addresses on the same port
+        string extra;
+        string_view token;
+        while (!(token = tokens->next()).empty())
+        {
+            ip::address a = ip::make_address(token, ec);
+            if (!ec)
+            {
+                extra += " " + a.to_string();
+            }
+        }
+        server.unregister_peer(shared_from_this());
+        name = string{peer};
+        private_endpoint = tcp::endpoint{address, port};
+        extra_addresses = move(extra);
+        reply("confirm_connection\r\n");
+        server.register_peer(shared_from_this());
+    }
+
+    void finish()
+    {
+        close();
+        server.unregister_peer(shared_from_this());
+    }
+};
+
+rendezvous_server::rendezvous_server(io_service &service,
+                                     const tcp::endpoint &endpoint) :
+    service(service),
+    acceptor{service}
+{
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(tcp::acceptor::reuse_address(true));
+    acceptor.bind(endpoint);
+    acceptor.listen();
+}
+
+void rendezvous_server::start()
+{
+    do_accept();
+}
+
+void rendezvous_server::stop()
+{
+    boost_error ec;
+    acceptor.close(ec);
+    for (auto &peer : peers)
+    {
+        if (session_ptr s = peer.second.lock())
+        {
+            s->close();
+        }
+    }
+}
+
+tcp::endpoint rendezvous_server::local_endpoint() const
+{
+    return acceptor.local_endpoint();
+}
+
+void rendezvous_server::do_accept()
+{
+    auto socket = make_shared<tcp::socket>(service);
+    acceptor.async_accept(*socket,
+        [this, socket](boost_error ec)
+        {
+            if (ec == error::operation_aborted)
+            {
+                return;
+            }
+            if (!ec)
+            {
+                make_shared<session>(*this, move(*socket))->start();
+            }
+            do_accept();
+        }
+    );
+}
+
+void rendezvous_server::register_peer(const session_ptr &s)
+{
+    peers[s->peer_name()] = s;
+
+    auto it = watchers.find(s->peer_name());
+    if (it == watchers.end())
+    {
+        return;
+    }
+    string event = "online " + s->peer_name() + "\r\n";
+    for (auto &w : it->second)
+    {
+        if (session_ptr watcher = w.lock())
+        {
+            watcher->send(event);
+        }
+    }
+    watchers.erase(it);
+}
+
+void rendezvous_server::unregister_peer(const session_ptr &s)
+{
+    auto it = peers.find(s->peer_name());
+    if (it != peers.end() && it->second.lock() == s)
+    {
+        peers.erase(it);
+    }
+}
+
+void rendezvous_server::add_watcher(const session_ptr &s, string name)
+{
+    auto it = peers.find(name);
+    if (it != peers.end() && !it->second.expired())
+    {
+        s->send("online " + name + "\r\n");
+        return;
+    }
+    watchers[move(name)].push_back(s);
+}
+
+string rendezvous_server::list_answer(const list_filter &filter) const
+{
+    string answer = "list";
+    size_t count = 0;
+    if (!filter.names.empty())
+    {
+        for (string_view name : filter.names)
+        {
+            if (count < filter.limit && peers.count(name) != 0)
+            {
+                answer += " ";
+                answer += name;
+                ++count;
+            }
+        }
+        answer += "\r\n";
+        return answer;
+    }
+
+    auto it = peers.lower_bound(filter.prefix);
+    if (filter.after >= filter.prefix)
+    {
+        it = peers.upper_bound(filter.after);
+    }
+    //names with the prefix are adjacent
+    for (; it != peers.end() && count < filter.limit &&
+           it->first.compare(0, filter.prefix.size(), filter.prefix) == 0;
+         ++it, ++count)
+    {
+        answer += " ";
+        answer += it->first;
+    }
+    answer += "\r\n";
+    return answer;
+}
+
+string rendezvous_server::info_answer(string_view name) const
+{
+    auto it = peers.find(name);
+    session_ptr s = it != peers.end() ? it->second.lock() : nullptr;
+    if (!s)
+    {
+        return "error unknown_peer\r\n";
+    }
+    return "info " + s->info() + "\r\n";
+}
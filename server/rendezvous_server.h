@@ -0,0 +1,57 @@
+#ifndef RENDEZVOUS_SERVER_H
+#define RENDEZVOUS_SERVER_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <map>
+#include <unordered_map>
+#include <boost/asio.hpp>
+
+#include "line_framer.h"
+
+//local stand-in of the rendezvous server speaking the client protocol:
+//connect, get_list, get_info and watch subscriptions
+class rendezvous_server
+{
+public:
+    //"get_list name=a name=b prefix=p after=n limit=n": exact names, or
+    //names with prefix (after a name for the next page), up to limit
+    struct list_filter
+    {
+        std::vector<std::string_view> names;
+        std::string_view prefix;
+        std::string_view after;
+        size_t limit = SIZE_MAX;
+    };
+
+    rendezvous_server(boost::asio::io_service &service,
+                      const boost::asio::ip::tcp::endpoint &endpoint);
+
+    void start();
+    void stop();
+    boost::asio::ip::tcp::endpoint local_endpoint() const;
+
+private:
+    class session;
+    using session_ptr = std::shared_ptr<session>;
+
+    boost::asio::io_service &service;
+    boost::asio::ip::tcp::acceptor acceptor;
+    //ordered, so prefix and page filters don't walk the whole registry
+    std::map<std::string, std::weak_ptr<session>, std::less<>> peers;
+    std::unordered_map<std::string,
+                       std::vector<std::weak_ptr<session>>> watchers;
+
+    void do_accept();
+    void register_peer(const session_ptr &s);
+    void unregister_peer(const session_ptr &s);
+    void add_watcher(const session_ptr &s, std::string name);
+
+    std::string list_answer(const list_filter &filter) const;
+    std::string info_answer(std::string_view name) const;
+};
+
+#endif // RENDEZVOUS_SERVER_H
@@ -0,0 +1,68 @@
+#ifndef SOCKET_OPTIONS_H
+#define SOCKET_OPTIONS_H
+
+#include <boost/asio.hpp>
+
+#ifdef SO_REUSEPORT
+using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET,
+                                                               SO_REUSEPORT>;
+#endif
+
+//let acceptor listen on the local port of the server connection and
+//outgoing sockets share ports with acceptors of other sessions
+template <typename Socket>
+void share_local_port(Socket &s, boost::system::error_code &ec)
+{
+    s.set_option(boost::asio::socket_base::reuse_address(true), ec);
+#ifdef SO_REUSEPORT
+    if (!ec)
+    {
+        s.set_option(reuse_port(true), ec);
+    }
+#endif
+}
+
+#if defined(TCP_KEEPIDLE) && defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+using keepalive_idle = boost::asio::detail::socket_option::integer<
+        IPPROTO_TCP, TCP_KEEPIDLE>;
+using keepalive_interval = boost::asio::detail::socket_option::integer<
+        IPPROTO_TCP, TCP_KEEPINTVL>;
+using keepalive_count = boost::asio::detail::socket_option::integer<
+        IPPROTO_TCP, TCP_KEEPCNT>;
+#endif
+#ifdef TCP_USER_TIMEOUT
+using user_timeout = boost::asio::detail::socket_option::integer<
+        IPPROTO_TCP, TCP_USER_TIMEOUT>;
+#endif
+
+//kernel notices a dead friend as well: unacknowledged data fails the socket
+//after timeout, probes of an idle link start after a second (the shortest
+//keepalive time)
+template <typename Socket>
+void detect_dead_peer(Socket &s, unsigned timeout_ms,
+                      boost::system::error_code &ec)
+{
+    s.set_option(boost::asio::socket_base::keep_alive(true), ec);
+#if defined(TCP_KEEPIDLE) && defined(TCP_KEEPINTVL) && defined(TCP_KEEPCNT)
+    if (!ec)
+    {
+        s.set_option(keepalive_idle(1), ec);
+    }
+    if (!ec)
+    {
+        s.set_option(keepalive_interval(1), ec);
+    }
+    if (!ec)
+    {
+        s.set_option(keepalive_count(3), ec);
+    }
+#endif
+#ifdef TCP_USER_TIMEOUT
+    if (!ec)
+    {
+        s.set_option(user_timeout(static_cast<int>(timeout_ms)), ec);
+    }
+#endif
+}
+
+#endif // SOCKET_OPTIONS_H
@@ -0,0 +1,86 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <cstddef>
+#include <atomic>
+#include <memory>
+
+//bounded lock-free queue of one producer and one consumer thread; slots
+//are reused in place, so producer may swap its value with the slot one
+//and keep the capacity of strings, for example
+template <typename T>
+class spsc_ring
+{
+public:
+    //capacity is rounded up to a power of two
+    explicit spsc_ring(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size *= 2;
+        }
+        slots.reset(new T[size]);
+        mask = size - 1;
+    }
+
+    spsc_ring(const spsc_ring &) = delete;
+    spsc_ring &operator=(const spsc_ring &) = delete;
+
+    //producer: fill(T &slot) stores the value, false when ring is full
+    template <typename F>
+    bool push(F fill)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - cached_head > mask)
+        {
+            cached_head = head.load(std::memory_order_acquire);
+            if (t - cached_head > mask)
+            {
+                return false;
+            }
+        }
+        fill(slots[t & mask]);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    //consumer: take(T &slot) is called for every queued value until it
+    //returns false (that value stays queued); returns count of taken
+    template <typename F>
+    size_t consume(F take)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        size_t t = tail.load(std::memory_order_acquire);
+        size_t taken = 0;
+        while (h != t && take(slots[h & mask]))
+        {
+            ++h;
+            ++taken;
+            //publish freed slots in batches, not per value
+            if ((taken & 63) == 0)
+            {
+                head.store(h, std::memory_order_release);
+            }
+        }
+        head.store(h, std::memory_order_release);
+        return taken;
+    }
+
+    bool empty() const
+    {
+        return head.load(std::memory_order_acquire) ==
+               tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::unique_ptr<T[]> slots;
+    size_t mask;
+    //indexes grow forever, producer and consumer own a cache line each
+    alignas(64) std::atomic<size_t> head{0};
+    alignas(64) std::atomic<size_t> tail{0};
+    //producer's copy of head, refreshed only when ring looks full
+    size_t cached_head = 0;
+};
+
+#endif // SPSC_RING_H
@@ -0,0 +1,54 @@
+#ifndef TOKEN_CURSOR_H
+#define TOKEN_CURSOR_H
+
+#include <string_view>
+#include <charconv>
+#include <cstdint>
+
+//walks space separated tokens of a line without copying them
+class token_cursor
+{
+public:
+    explicit token_cursor(std::string_view s) : s{s} {}
+
+    //next token, empty when line is over
+    std::string_view next()
+    {
+        skip_spaces();
+        size_t space_index = s.find(' ');
+        std::string_view token = s.substr(0, space_index);
+        s.remove_prefix(space_index == std::string_view::npos ?
+                            s.size() : space_index + 1);
+        return token;
+    }
+
+    //text after the last token as is
+    std::string_view rest() const { return s; }
+    bool empty() const { return s.find_first_not_of(' ') ==
+                                std::string_view::npos; }
+
+    template <typename T>
+    static bool to_number(std::string_view token, T *value)
+    {
+        auto res = std::from_chars(token.data(), token.data() + token.size(),
+                                   *value);
+        return res.ec == std::errc{} &&
+               res.ptr == token.data() + token.size();
+    }
+
+    static bool to_port(std::string_view token, uint16_t *port)
+    {
+        return to_number(token, port);
+    }
+
+private:
+    std::string_view s;
+
+    void skip_spaces()
+    {
+        size_t index = s.find_first_not_of(' ');
+        s.remove_prefix(index == std::string_view::npos ? s.size() : index);
+    }
+};
+
+#endif // TOKEN_CURSOR_H